@@ -0,0 +1,293 @@
+#include "db/catalog.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::db
+{
+    namespace
+    {
+        const std::string CATALOG_FILE = ".keys";
+        const std::string TABLE_FILE = ".keys.table";
+        const std::string INDEX_FILE = "_.i";
+
+        bool is_hidden(const fs::path& p)
+        {
+            const auto name = p.filename().string();
+            return !name.empty() && name[0] == '.';
+        }
+
+        //bytes of the count and offsets before the keys of a table
+        std::size_t table_header(std::size_t count)
+        {
+            return sizeof(std::uint64_t) * (count + 2);
+        }
+
+        //flushes a file or directory to disk so a rename or truncate after it is safe
+        void sync(const fs::path& p)
+        {
+            const int fd = ::open(p.string().c_str(), O_RDONLY);
+            if(fd < 0 || ::fsync(fd) != 0)
+            {
+                const auto error = std::strerror(errno);
+                if(fd >= 0) ::close(fd);
+                throw std::runtime_error{"unable to sync " + p.string() + ": " + error};
+            }
+            ::close(fd);
+        }
+    }
+
+    key_catalog::key_catalog(const fs::path& root) :
+        _root{root}, _log_file{root / CATALOG_FILE}, _table_file{root / TABLE_FILE}
+    {
+        REQUIRE(!root.empty());
+
+        bool has_table = fs::exists(_table_file);
+        if(has_table) 
+        {
+            //a corrupt table is rebuilt from the data directory with the log on top
+            try { map_table(); }
+            catch(std::runtime_error& e)
+            {
+                std::cerr << e.what() << ", rebuilding" << std::endl;
+                _table.reset();
+                _table_size = 0;
+                _offsets = nullptr;
+                _strings = nullptr;
+                has_table = false;
+                rebuild();
+            }
+        }
+
+        if(fs::exists(_log_file)) load();
+        else if(!has_table) rebuild();
+
+        compact();
+
+        _log.open(_log_file.string(), std::ios::out | std::ios::app);
+        if(!_log) throw std::runtime_error{"unable to open key catalog " + _log_file.string()};
+    }
+
+    //keys already in the table were logged before the table was written
+    void key_catalog::load()
+    {
+        std::ifstream in{_log_file.string()};
+        std::string key;
+        while(std::getline(in, key))
+            if(!key.empty() && !table_contains(key)) _keys.insert(key);
+    }
+
+    /**
+     * Keys are split into directories by the db, so the key of a timeline is
+     * the concatenation of the directories from the root to its index.
+     */
+    void key_catalog::rebuild()
+    {
+        if(!fs::exists(_root)) return;
+
+        for(fs::recursive_directory_iterator it{_root}, end; it != end; it++)
+        {
+            const auto& p = it->path();
+            if(is_hidden(p))
+            {
+                if(fs::is_directory(p)) it.no_push();
+                continue;
+            }
+
+            if(p.filename() != INDEX_FILE) continue;
+
+            std::string key;
+            for(const auto& d : fs::relative(p.parent_path(), _root))
+                key += d.string();
+
+            if(!key.empty()) _keys.insert(key);
+        }
+    }
+
+    /**
+     * Merges the keys in memory into a new table and empties the log. The table
+     * is written to a temporary file, synced and renamed so a crash leaves either
+     * the old table and the log, which still has the keys, or the new table.
+     * The log is only emptied after the rename is on disk.
+     */
+    void key_catalog::compact()
+    {
+        if(_keys.empty()) return;
+
+        std::vector<stde::string_view> keys;
+        keys.reserve(_table_size + _keys.size());
+
+        std::size_t t = 0;
+        for(const auto& k : _keys)
+        {
+            for(; t < _table_size && table_key(t) < k; t++) keys.push_back(table_key(t));
+            keys.emplace_back(k.data(), k.size());
+        }
+        for(; t < _table_size; t++) keys.push_back(table_key(t));
+
+        const auto tmp = _table_file.string() + ".tmp";
+        {
+            std::ofstream out{tmp, std::ios::out | std::ios::trunc | std::ios::binary};
+
+            const std::uint64_t count = keys.size();
+            out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+            std::uint64_t offset = 0;
+            for(const auto& k : keys)
+            {
+                out.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+                offset += k.size();
+            }
+            out.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+
+            for(const auto& k : keys) out.write(k.data(), k.size());
+
+            out.flush();
+            if(!out) throw std::runtime_error{"unable to write key catalog " + tmp};
+        }
+        sync(tmp);
+
+        //the keys point into the old table so it is unmapped after writing the new one
+        _table.reset();
+        fs::rename(tmp, _table_file);
+        sync(_root);
+
+        std::ofstream log{_log_file.string(), std::ios::out | std::ios::trunc};
+        if(!log) throw std::runtime_error{"unable to truncate key catalog " + _log_file.string()};
+
+        _keys.clear();
+        map_table();
+    }
+
+    void key_catalog::map_table()
+    {
+        _table.reset();
+        _table_size = 0;
+        _offsets = nullptr;
+        _strings = nullptr;
+
+        if(fs::file_size(_table_file) == 0) return;
+
+        _table = std::make_unique<util::mapped_file>();
+        _table->open(_table_file, 1);
+
+        const auto size = _table->size();
+        const auto data = _table->data();
+
+        std::uint64_t count = 0;
+        if(size >= sizeof(count)) count = *reinterpret_cast<const std::uint64_t*>(data);
+
+        if(size < sizeof(count) || table_header(count) > size)
+            throw std::runtime_error{"key catalog " + _table_file.string() + " is corrupt"};
+
+        _offsets = reinterpret_cast<const std::uint64_t*>(data) + 1;
+        _strings = data + table_header(count);
+        _table_size = count;
+
+        if(table_header(count) + _offsets[count] > size)
+            throw std::runtime_error{"key catalog " + _table_file.string() + " is corrupt"};
+    }
+
+    stde::string_view key_catalog::table_key(std::size_t i) const
+    {
+        REQUIRE_LESS(i, _table_size);
+        return stde::string_view{_strings + _offsets[i], _offsets[i + 1] - _offsets[i]};
+    }
+
+    std::size_t key_catalog::table_bound(const stde::string_view& k, bool after) const
+    {
+        std::size_t first = 0;
+        std::size_t last = _table_size;
+        while(first < last)
+        {
+            const auto mid = first + (last - first) / 2;
+            const auto c = table_key(mid).compare(k);
+            if(c < 0 || (after && c == 0)) first = mid + 1;
+            else last = mid;
+        }
+        return first;
+    }
+
+    bool key_catalog::table_contains(const stde::string_view& k) const
+    {
+        const auto i = table_bound(k, false);
+        return i < _table_size && table_key(i) == k;
+    }
+
+    void key_catalog::add(const stde::string_view& key)
+    {
+        REQUIRE_FALSE(key.empty());
+
+        if(contains(key)) return;
+
+        std::unique_lock<std::shared_mutex> lock{_mutex};
+
+        auto r = _keys.emplace(key.data(), key.size());
+        if(!r.second) return;
+
+        _log << *r.first << '\n';
+        _log.flush();
+
+        //a key that is not logged would be lost on restart, so the add fails
+        if(!_log) 
+        {
+            _keys.erase(r.first);
+            _log.clear();
+            throw std::runtime_error{"unable to write key catalog " + _log_file.string()};
+        }
+    }
+
+    bool key_catalog::contains(const stde::string_view& key) const
+    {
+        std::shared_lock<std::shared_mutex> lock{_mutex};
+        return table_contains(key) || _keys.find(key) != std::end(_keys);
+    }
+
+    std::size_t key_catalog::size() const
+    {
+        std::shared_lock<std::shared_mutex> lock{_mutex};
+        return _table_size + _keys.size();
+    }
+
+    key_list key_catalog::scan(
+            const std::string& prefix,
+            const std::string& cursor,
+            const bool started,
+            const std::size_t max) const
+    {
+        REQUIRE_GREATER(max, 0);
+
+        std::shared_lock<std::shared_mutex> lock{_mutex};
+
+        //the table and the keys in memory never overlap so they are merged in order
+        auto t = started ? table_bound(cursor, true) : table_bound(prefix, false);
+        auto it = started ? _keys.upper_bound(cursor) : _keys.lower_bound(prefix);
+
+        key_list keys;
+        while(keys.size() < max)
+        {
+            const bool has_table = t < _table_size;
+            const bool has_keys = it != std::end(_keys);
+            if(!has_table && !has_keys) break;
+
+            std::string k;
+            if(has_table && (!has_keys || table_key(t) < stde::string_view{*it}))
+                k = table_key(t++).to_string();
+            else
+                k = *it++;
+
+            if(k.compare(0, prefix.size(), prefix) != 0) break;
+            keys.push_back(std::move(k));
+        }
+
+        return keys;
+    }
+}
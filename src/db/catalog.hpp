@@ -0,0 +1,82 @@
+#ifndef HENHOUSE_CATALOG_H
+#define HENHOUSE_CATALOG_H
+
+#include <experimental/string_view>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "util/mmap.hpp"
+
+namespace stde = std::experimental;
+
+namespace henhouse::db
+{
+    using key_list = std::vector<std::string>;
+
+    /**
+     * Sorted set of all keys in the db, so keys can be found without walking
+     * the data directory. Keys are kept in a memory mapped sorted table, and keys
+     * added since the table was written are kept in memory and appended to a log.
+     * On startup the log is merged into the table. If neither exists they are
+     * rebuilt from the data directory once.
+     *
+     * The table has the number of keys, the offsets of each key and one past
+     * the last, then the keys without separators.
+     *
+     * This interface is thread safe.
+     */
+    class key_catalog
+    {
+        public:
+            key_catalog(const boost::filesystem::path& root);
+
+            //adds the sanatized key if it is new
+            void add(const stde::string_view& key);
+            bool contains(const stde::string_view& key) const;
+            std::size_t size() const;
+
+            /**
+             * Returns up to max keys starting with prefix in sorted order. If started
+             * is true then only keys after the cursor are returned.
+             */
+            key_list scan(
+                    const std::string& prefix,
+                    const std::string& cursor,
+                    const bool started,
+                    const std::size_t max) const;
+
+        private:
+            void load();
+            void rebuild();
+            void compact();
+            void map_table();
+
+            stde::string_view table_key(std::size_t i) const;
+
+            //first position in the table with a key not less than k, or greater than k if after is true
+            std::size_t table_bound(const stde::string_view& k, bool after) const;
+            bool table_contains(const stde::string_view& k) const;
+
+        private:
+            boost::filesystem::path _root;
+            boost::filesystem::path _log_file;
+            boost::filesystem::path _table_file;
+
+            util::mapped_file_ptr _table;
+            std::size_t _table_size = 0;
+            const std::uint64_t* _offsets = nullptr;
+            const char* _strings = nullptr;
+
+            //keys not in the table, looked up by string_view without a copy
+            std::set<std::string, std::less<>> _keys;
+            std::ofstream _log;
+            mutable std::shared_mutex _mutex;
+    };
+}
+#endif
@@ -1,7 +1,10 @@
 #include "db/db.hpp"
+#include "util/glob.hpp"
 
 #include <algorithm>
 #include <functional>
+#include <limits>
+#include <unordered_set>
 #include <boost/filesystem.hpp>
 
 #include <boost/regex.hpp>
@@ -16,6 +19,12 @@ namespace henhouse::db
         const int MAX_DIR_SPLIT_LENGTH = MAX_DIR_LENGTH * 4;
         const offset_type NO_OFFSET = 0;
 
+        //even like sealed versions but past any start position a timeline could have
+        const version_type UNKNOWN_VERSION = std::numeric_limits<version_type>::max() - 1;
+
+        //sanatized keys never start with a dot so this never clashes with a key
+        const std::string PAIRS_DIR = ".pairs";
+
         fs::path get_key_dir(const fs::path& root, const stde::string_view& key)
         {
             REQUIRE(!key.empty());
@@ -49,14 +58,56 @@ namespace henhouse::db
                 }, '_');
     }
 
+    void sanatize_glob(std::string& res, const stde::string_view& glob)
+    {
+        res.assign(glob.data(), glob.size());
+        std::replace_if(std::begin(res), std::end(res),
+                [](char c)
+                {
+                return !((c >= '0' && c <= '9') ||
+                        (c >= 'A' && c <= 'Z') ||
+                        (c >= 'a' && c <= 'z') ||
+                        c == '*' || c == '?');
+                }, '_');
+    }
+
+    feature_set match_features(const feature_rules& rules, const stde::string_view& key)
+    {
+        feature_set features = NO_FEATURES;
+        for(const auto& r : rules)
+            if(util::glob_match(r.glob, key)) features |= r.features;
+
+        return features;
+    }
+
+    time_type match_retention(const retention_rules& rules, const stde::string_view& key)
+    {
+        for(const auto& r : rules)
+            if(util::glob_match(r.glob, key)) return r.seconds;
+
+        return 0;
+    }
+
+    const ring_rule* match_ring(const ring_rules& rules, const stde::string_view& key)
+    {
+        for(const auto& r : rules)
+            if(util::glob_match(r.glob, key)) return &r;
+
+        return nullptr;
+    }
+
     summary_result timeline_db::summary(const stde::string_view& key) const
     {
+        if(!known(key)) return summary_result{0, 0, new_resolution(key), 0, 0, 0, 0};
+
         const auto& tl = get_tl(key);
         return tl.summary();
     }
 
     get_result timeline_db::get(const stde::string_view& key, time_type t) const 
     {
+        if(!known(key)) return get_result{0, t, t, 0, 0, data_item{0, 0, 0}};
+
         const auto& tl = get_tl(key);
         return tl.get(t, NO_OFFSET);
     }
@@ -67,10 +118,177 @@ namespace henhouse::db
         return tl.put(t, count);
     }
 
+    bool timeline_db::observe(const stde::string_view& key, time_type t, count_type v)
+    {
+        auto& tl = get_tl(key);
+        return tl.observe(t, v);
+    }
+
+    std::size_t diff_key_hash::operator()(const diff_key& k) const
+    {
+        auto h = std::hash<std::string>{}(k.key);
+        h ^= std::hash<time_type>{}(k.a) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h ^= std::hash<time_type>{}(k.b) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+
     diff_result timeline_db::diff(const stde::string_view& key, time_type a, time_type b, const offset_type index_offset) const
     {
+        if(!known(key)) 
+        {
+            if(a > b) std::swap(a, b);
+            return diff_result{a, b, new_resolution(key), 0, 0, 0, 0, 0, {0}, {0}, match_features(_features, key)};
+        }
+
+        if(!_cache_results)
+        {
+            const auto& tl = get_tl(key);
+            return tl.diff(a, b, index_offset);
+        }
+
+        //sealed ranges are answered without touching the timeline
+        diff_key k{key.to_string(), a, b};
+        const bool retained = retained_before(key, std::min(a, b));
+        if(retained) _results.erase(k);
+        else
+        {
+            const auto c = _results.find(k);
+            if(c != std::end(_results)) return c->second;
+        }
+
+        const auto& tl = get_tl(key);
+        const auto r = tl.diff(a, b, index_offset);
+
+        //the start of a ring timeline moves with puts so its sealed ranges can still change
+        if(tl.ring == 0 && !retained && tl.sealed(std::max(a, b))) _results.set(std::move(k), r);
+        return r;
+    }
+
+    version_type timeline_db::version(const stde::string_view& key, time_type t) const
+    {
+        if(!known(key)) return UNKNOWN_VERSION;
+
         const auto& tl = get_tl(key);
-        return tl.diff(a, b, index_offset);
+        return tl.version(t);
+    }
+
+    bool timeline_db::put_pair(const key_pair& p, pair_side side, time_type t, count_type c)
+    {
+        auto& tl = get_pair(p);
+        return tl.put(t, side, c);
+    }
+
+    corr_result timeline_db::corr(const key_pair& p, time_type a, time_type b) const
+    {
+        const auto& tl = get_pair(p);
+        return tl.corr(a, b);
+    }
+
+    diff_result timeline_db::peek_diff(const stde::string_view& key, time_type a, time_type b) const
+    {
+        REQUIRE_FALSE(key.empty());
+
+        //a cached timeline that was unmapped is read like an uncached one so scans don't map it again
+        const auto t = _tls.peek(key.to_string());
+        if(t && t->mapped()) return t->diff(a, b, NO_OFFSET);
+
+        if(!t && !known(key)) return diff_result{a, b, _new_tl_resolution};
+
+        //opened read only and unmapped once the diff is done
+        const auto tl = open_tl(key, get_key_dir(_root, key), true);
+        return tl.diff(a, b, NO_OFFSET);
+    }
+
+    bool timeline_db::retain(const stde::string_view& key, time_type now)
+    {
+        REQUIRE_FALSE(key.empty());
+
+        const auto seconds = match_retention(_retention, key);
+        if(seconds == 0 || seconds >= now) return false;
+
+        bool truncated = false;
+        const auto t = _tls.peek(key.to_string());
+        if(t)
+        {
+            //a cached timeline that was unmapped is unmapped again once truncated
+            const bool unmapped = !t->mapped();
+            t->map();
+            truncated = t->truncate(now - seconds);
+            if(unmapped) t->unmap();
+        }
+        else
+        {
+            if(!known(key)) return false;
+
+            //opened with its features and rollups so they are truncated too, unmapped once truncated
+            auto tl = open_tl(key, get_key_dir(_root, key));
+            truncated = tl.truncate(now - seconds);
+        }
+
+        //cached results of ranges before the new start are skipped by retained_before
+        _retained_at = std::max(_retained_at, now);
+        return truncated;
+    }
+
+    /**
+     * Retention truncates before now minus the seconds of the key, so a range 
+     * starting at or after that for the latest retention run is never changed by it.
+     */
+    bool timeline_db::retained_before(const stde::string_view& key, time_type t) const
+    {
+        if(_retained_at == 0) return false;
+
+        const auto seconds = match_retention(_retention, key);
+        return seconds != 0 && seconds < _retained_at && t < _retained_at - seconds;
+    }
+
+    mean_type top_score(const diff_result& r, top_stat by)
+    {
+        switch(by)
+        {
+            case top_stat::mean: return r.mean;
+            case top_stat::variance: return r.variance;
+            default: return r.sum;
+        }
+    }
+
+    namespace
+    {
+        //orders the heap with the smallest score on top
+        bool higher_score(const top_item& a, const top_item& b) 
+        {
+            return a.score > b.score;
+        }
+    }
+
+    void push_top(top_items& heap, std::size_t n, top_item item)
+    {
+        REQUIRE_GREATER(n, 0);
+
+        if(heap.size() < n)
+        {
+            heap.emplace_back(std::move(item));
+            std::push_heap(std::begin(heap), std::end(heap), higher_score);
+            return;
+        }
+
+        if(!higher_score(item, heap.front())) return;
+
+        std::pop_heap(std::begin(heap), std::end(heap), higher_score);
+        heap.back() = std::move(item);
+        std::push_heap(std::begin(heap), std::end(heap), higher_score);
+
+        ENSURE_LESS_EQUAL(heap.size(), n);
+    }
+
+    void sort_top(top_items& heap)
+    {
+        std::sort_heap(std::begin(heap), std::end(heap), higher_score);
+    }
+
+    std::string pair_id(const key_pair& p)
+    {
+        return p.x + "," + p.y;
     }
 
     std::size_t timeline_db::key_index_size(const stde::string_view& key) const
@@ -89,36 +307,183 @@ namespace henhouse::db
     {
         REQUIRE_FALSE(key.empty());
 
-        const auto h = std::hash<stde::string_view>{}(key);
+        const auto k = key.to_string();
+
+        const auto t = _tls.find(k);
+        if(t) 
+        {
+            if(!t->mapped()) map_tl(k, *t);
+            t->accessed = ++_accesses;
+            return *t;
+        }
+
+        return cache_tl(k, open(key));
+    }
+
+    const timeline& timeline_db::get_tl(const stde::string_view& key) const
+    {
+        REQUIRE_FALSE(key.empty());
+
+        const auto k = key.to_string();
 
-        const auto t = _tls.find(h);
-        if(t != std::end(_tls)) return t->second;
+        const auto t = _tls.find(k);
+        if(t) 
+        {
+            if(!t->mapped()) map_tl(k, *t);
+            t->accessed = ++_accesses;
+            return *t;
+        }
+
+        return cache_tl(k, open(key));
+    }
+
+    timeline timeline_db::open(const stde::string_view& key) const
+    {
+        REQUIRE_FALSE(key.empty());
 
         const auto key_dir = get_key_dir(_root, key);
 
-        if(!fs::exists(key_dir)) fs::create_directories(key_dir);
+        //keys in the catalog already have their directory
+        if(!_catalog.contains(key)) fs::create_directories(key_dir);
+
+        auto t = open_tl(key, key_dir);
+        _catalog.add(key);
+        return t;
+    }
+
+    bool timeline_db::known(const stde::string_view& key) const
+    {
+        if(_catalog.contains(key)) return true;
 
-        _tls.set(h, from_directory(key_dir.string(), _new_tl_resolution));
-        auto p = _tls.find(h);
+        //a key lost from the catalog still has its timeline on disk, so it is added back
+        if(!fs::exists(get_key_dir(_root, key) / "_.i")) return false;
 
-        return p->second;
+        _catalog.add(key);
+        return true;
     }
 
-    const timeline& timeline_db::get_tl(const stde::string_view& key) const
+    time_type timeline_db::new_resolution(const stde::string_view& key) const
+    {
+        const auto ring = match_ring(_rings, key);
+        return ring != nullptr && ring->resolution > 0 ? ring->resolution : _new_tl_resolution;
+    }
+
+    bool timeline_db::cached(const std::string& key) const
+    {
+        return _tls.peek(key) != nullptr;
+    }
+
+    void timeline_db::adopt(const std::string& key, timeline t)
     {
         REQUIRE_FALSE(key.empty());
+        if(cached(key)) return;
 
-        const auto h = std::hash<stde::string_view>{}(key);
+        _tls.missed(key);
+        cache_tl(key, std::move(t));
+    }
 
-        const auto t = _tls.find(h);
-        if(t != std::end(_tls)) return t->second;
+    timeline& timeline_db::cache_tl(const std::string& key, timeline t) const
+    {
+        if(_mapped_budget > 0 && util::mapped_bytes() > _mapped_budget) release_cold();
 
-        const auto key_dir = get_key_dir(_root, key);
+        auto& p = _tls.set(key, std::move(t));
+        p.accessed = ++_accesses;
+        track(key, p);
+        return p;
+    }
+
+    void timeline_db::map_tl(const std::string& key, timeline& t) const
+    {
+        REQUIRE_FALSE(t.mapped());
+
+        if(_mapped_budget > 0 && util::mapped_bytes() > _mapped_budget) release_cold();
+        t.map();
+        track(key, t);
+    }
+
+    void timeline_db::track(const std::string& key, const timeline& t) const
+    {
+        if(_mapped_budget == 0) return;
+
+        _mapped.emplace_back(key, t.accessed);
+        if(_mapped.size() <= 2 * _tls.size() + 1) return;
+
+        //drops keys evicted, unmapped, or queued again later, keeping the latest
+        std::unordered_set<std::string> queued;
+        std::deque<std::pair<std::string, std::uint64_t>> live;
+        for(auto it = _mapped.rbegin(); it != _mapped.rend(); it++)
+        {
+            const auto c = _tls.peek(it->first);
+            if(c && c->mapped() && queued.insert(it->first).second) live.push_front(std::move(*it));
+        }
+        _mapped.swap(live);
+    }
+
+    timeline timeline_db::open_tl(const stde::string_view& key, const fs::path& dir, bool read_only) const
+    {
+        const auto ring = match_ring(_rings, key);
+        const auto resolution = new_resolution(key);
+        const offset_type ring_size = ring == nullptr ? 0 : std::max<offset_type>(ring->seconds / resolution, 1);
+
+        if(read_only) 
+        {
+            auto t = read_directory(dir.string(), resolution, _rollups, ring_size);
+            if(ring != nullptr) t.ring = std::max<offset_type>(ring->seconds / t.index.meta().resolution, 1);
+            return t;
+        }
+
+        const auto features = match_features(_features, key);
+        if(ring == nullptr) return from_directory(dir.string(), _new_tl_resolution, features, _rollups);
+
+        auto t = from_directory(dir.string(), resolution, features, _rollups, ring_size);
+
+        //an existing timeline keeps the resolution it was created with
+        t.ring = std::max<offset_type>(ring->seconds / t.index.meta().resolution, 1);
+        return t;
+    }
+
+    void timeline_db::release_cold() const
+    {
+        //stop a little below the budget so this doesn't run on every open
+        const auto low = _mapped_budget - _mapped_budget / 8;
+
+        //each timeline goes to the back at most once so this ends within two passes
+        auto chances = _mapped.size();
+        while(!_mapped.empty() && util::mapped_bytes() > low)
+        {
+            auto c = std::move(_mapped.front());
+            _mapped.pop_front();
+
+            //evicted or unmapped since it was queued
+            const auto t = _tls.peek(c.first);
+            if(!t || !t->mapped()) continue;
+
+            if(t->accessed > c.second && chances > 0)
+            {
+                chances--;
+                c.second = t->accessed;
+                _mapped.push_back(std::move(c));
+                continue;
+            }
+
+            //unmapped timelines stay cached and are mapped again when used
+            t->unmap();
+        }
+    }
+
+    pair_timeline& timeline_db::get_pair(const key_pair& p) const
+    {
+        REQUIRE_FALSE(p.x.empty());
+        REQUIRE_FALSE(p.y.empty());
+
+        const auto id = pair_id(p);
+
+        const auto t = _pairs.find(id);
+        if(t != std::end(_pairs)) return t->second;
 
-        if(!fs::exists(key_dir)) fs::create_directories(key_dir);
+        const auto dir = _root / PAIRS_DIR / p.x / p.y;
+        auto r = _pairs.emplace(id, pair_from_directory(dir.string(), _new_tl_resolution));
 
-        _tls.set(h, from_directory(key_dir.string(), _new_tl_resolution));
-        auto p = _tls.find(h);
-        return p->second;
+        return r.first->second;
     }
 }
@@ -2,15 +2,138 @@
 #define HENHOUSE_DB_H
 
 #include "db/timeline.hpp"
+#include "db/pair.hpp"
+#include "db/catalog.hpp"
+#include "util/lfu_cache.hpp"
 
+#include <deque>
 #include <experimental/string_view>
+#include <vector>
+#include <unordered_map>
 #include <folly/EvictingCacheMap.h>
 
 namespace stde = std::experimental;
 
 namespace henhouse::db
 {
-    using timeline_cache = folly::EvictingCacheMap<std::size_t, timeline>;
+    /**
+     * Timelines are cached by their full key. The cache admits a timeline only if its
+     * key is used more often than the one it would evict, so scans don't flush it.
+     */
+    using timeline_cache = util::lfu_cache<std::string, timeline>;
+
+    /**
+     * Features enabled for new and existing timelines with keys 
+     * matching the glob. The glob should be sanatized first using
+     * the sanatize_glob function.
+     */
+    struct feature_rule
+    {
+        std::string glob;
+        feature_set features;
+    };
+
+    using feature_rules = std::vector<feature_rule>;
+
+    /**
+     * Timelines with keys matching the glob only keep the buckets
+     * of the last seconds. The glob should be sanatized first.
+     */
+    struct retention_rule
+    {
+        std::string glob;
+        time_type seconds;
+    };
+
+    using retention_rules = std::vector<retention_rule>;
+
+    /**
+     * Timelines with keys matching the glob are ring timelines keeping 
+     * the last seconds of buckets. New timelines get the resolution of the
+     * rule, or the default resolution if it is 0. The glob should be sanatized first.
+     */
+    struct ring_rule
+    {
+        std::string glob;
+        time_type seconds;
+        time_type resolution;
+    };
+
+    using ring_rules = std::vector<ring_rule>;
+
+    /**
+     * Keys declared as a pair have a pair timeline maintained on put.
+     * The keys should be sanatized first.
+     */
+    struct key_pair
+    {
+        std::string x;
+        std::string y;
+    };
+
+    using key_pairs = std::vector<key_pair>;
+    using pair_timelines = std::unordered_map<std::string, pair_timeline>;
+
+    struct diff_key
+    {
+        std::string key;
+        time_type a;
+        time_type b;
+
+        bool operator==(const diff_key& o) const
+        {
+            return a == o.a && b == o.b && key == o.key;
+        }
+    };
+
+    struct diff_key_hash
+    {
+        std::size_t operator()(const diff_key& k) const;
+    };
+
+    /**
+     * Caches diffs of sealed ranges. Since the buckets of a sealed range never 
+     * change the cached results never have to be invalidated, except for ranges
+     * retention truncated, which are skipped when looked up.
+     */
+    using result_cache = folly::EvictingCacheMap<diff_key, diff_result, diff_key_hash>;
+
+    enum class top_stat { sum, mean, variance };
+
+    struct top_item
+    {
+        std::string key;
+        diff_result result;
+        mean_type score;
+    };
+
+    using top_items = std::vector<top_item>;
+
+    /**
+     * State of a scan for the n keys with the largest stat between a and b.
+     * Keys are scanned in order so the scan can stop and continue from the cursor.
+     * The best keys so far are kept in a heap of at most n items.
+     */
+    struct top_scan
+    {
+        std::string glob;           //sanatized glob keys must match
+        std::string prefix;         //prefix of the glob before any wildcard
+        time_type a;
+        time_type b;
+        std::size_t n;
+        top_stat by;
+        std::string cursor;         //last key scanned
+        bool started = false;
+        top_items heap;
+    };
+
+    mean_type top_score(const diff_result& r, top_stat by);
+
+    //keeps the n items with the largest score in the heap
+    void push_top(top_items& heap, std::size_t n, top_item item);
+
+    //sorts the heap from largest to smallest score
+    void sort_top(top_items& heap);
 
     /**
      * Manages a cache of timelines based on key.
@@ -22,8 +145,28 @@ namespace henhouse::db
     class timeline_db 
     {
         public:
-            timeline_db(const std::string& root, const std::size_t cache_size, const time_type new_timeline_resolution) : 
-                _root{root}, _new_tl_resolution{new_timeline_resolution}, _tls{cache_size}
+            timeline_db(
+                    const std::string& root, 
+                    const std::size_t cache_size, 
+                    const std::size_t result_cache_size, 
+                    const time_type new_timeline_resolution,
+                    const feature_rules& features,
+                    const rollup_resolutions& rollups,
+                    const retention_rules& retention,
+                    const ring_rules& rings,
+                    const std::size_t mapped_budget,
+                    key_catalog& catalog) : 
+                _root{root}, 
+                _new_tl_resolution{new_timeline_resolution}, 
+                _features{features},
+                _rollups{rollups},
+                _retention{retention},
+                _rings{rings},
+                _tls{cache_size},
+                _results{std::max<std::size_t>(result_cache_size, 1)},
+                _cache_results{result_cache_size > 0},
+                _mapped_budget{mapped_budget},
+                _catalog{catalog}
             {
                 REQUIRE(!root.empty());
                 REQUIRE_GREATER(cache_size, 0);
@@ -35,24 +178,128 @@ namespace henhouse::db
             summary_result summary(const stde::string_view& key) const;
             get_result get(const stde::string_view& key, time_type t) const;
             bool put(const stde::string_view& key, time_type t, count_type c);
+            bool observe(const stde::string_view& key, time_type t, count_type v);
             diff_result diff(const stde::string_view& key, time_type a, time_type b, const offset_type index_offset) const;
+            version_type version(const stde::string_view& key, time_type t) const;
+
+            //diff that does not change which timelines are cached.
+            //Timelines not in the cache are opened read only just for the diff.
+            diff_result peek_diff(const stde::string_view& key, time_type a, time_type b) const;
+
+            /**
+             * Truncates the timeline of the key to the retention of the first rule
+             * matching it. Like peek_diff this does not change which timelines
+             * are cached. Returns true if the timeline was truncated.
+             */
+            bool retain(const stde::string_view& key, time_type now);
+
+            bool put_pair(const key_pair& p, pair_side side, time_type t, count_type c);
+            corr_result corr(const key_pair& p, time_type a, time_type b) const;
             std::size_t key_index_size(const stde::string_view& key) const;
             std::size_t key_data_size(const stde::string_view& key) const;
 
+            /**
+             * Opens the timeline of the key without caching it, creating it if needed.
+             * Safe to call from any thread so timelines can be opened off the worker.
+             */
+            timeline open(const stde::string_view& key) const;
+
+            bool cached(const std::string& key) const;
+
+            /**
+             * True if the key has a timeline. Queries on unknown keys return empty 
+             * results without opening anything. Only puts create timelines. Keys
+             * missing from the catalog but with a timeline on disk are added back.
+             */
+            bool known(const stde::string_view& key) const;
+
+            //caches a timeline returned by open unless the key is already cached
+            void adopt(const std::string& key, timeline t);
+
+            //hits, misses and evictions of the timeline cache. Safe to call from any thread.
+            util::cache_stats cache_stats() const { return _tls.stats(); }
+
         private:
 
             timeline& get_tl(const stde::string_view& key);
             const timeline& get_tl(const stde::string_view& key) const;
+            //a read only open doesn't create, update or build anything, for scans
+            timeline open_tl(const stde::string_view& key, const boost::filesystem::path& dir, bool read_only = false) const;
+            timeline& cache_tl(const std::string& key, timeline t) const;
+
+            //resolution a new timeline of the key is created with
+            time_type new_resolution(const stde::string_view& key) const;
+
+            /**
+             * Unmaps cached timelines until the bytes mapped by all workers are below 
+             * the budget, in the order they were mapped, giving timelines accessed since 
+             * a second chance. They stay cached. Returns once this worker has nothing
+             * left to unmap.
+             */
+            void release_cold() const;
+
+            //maps an unmapped cached timeline again, making room first if over the budget
+            void map_tl(const std::string& key, timeline& t) const;
+
+            //queues a timeline that was just mapped so release_cold can unmap it
+            void track(const std::string& key, const timeline& t) const;
+
+            //true if retention may have truncated the timeline of the key after t
+            bool retained_before(const stde::string_view& key, time_type t) const;
+            pair_timeline& get_pair(const key_pair& p) const;
 
         private:
             boost::filesystem::path _root;
             time_type _new_tl_resolution;
+            feature_rules _features;
+            rollup_resolutions _rollups;
+            retention_rules _retention;
+            ring_rules _rings;
             mutable timeline_cache _tls;
+            mutable result_cache _results;
+            bool _cache_results;
+            std::size_t _mapped_budget;
+            mutable std::uint64_t _accesses = 0;
+
+            //keys of mapped timelines in the order they were mapped, with their access then
+            mutable std::deque<std::pair<std::string, std::uint64_t>> _mapped;
+
+            //now of the latest retention run, cached results before it are not used
+            time_type _retained_at = 0;
+            key_catalog& _catalog;
+
+            //declared pairs are few so they are kept open
+            mutable pair_timelines _pairs;
     };
 
     /**
      * Sanitizes the key to valid characters used in the db.
      */
     void sanatize_key(std::string& res, const stde::string_view& key);
+
+    /**
+     * Identifies a pair. Sanatized keys never have a comma so ids are unique.
+     */
+    std::string pair_id(const key_pair& p);
+
+    /**
+     * Sanitizes a glob like a key but keeps the * and ? wildcards.
+     */
+    void sanatize_glob(std::string& res, const stde::string_view& glob);
+
+    /**
+     * Returns the union of features of all rules matching the key.
+     */
+    feature_set match_features(const feature_rules& rules, const stde::string_view& key);
+
+    /**
+     * Returns the seconds of the first rule matching the key or 0 if none match.
+     */
+    time_type match_retention(const retention_rules& rules, const stde::string_view& key);
+
+    /**
+     * Returns the first ring rule matching the key or nullptr if none match.
+     */
+    const ring_rule* match_ring(const ring_rules& rules, const stde::string_view& key);
 }
 #endif
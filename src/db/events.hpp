@@ -0,0 +1,84 @@
+#ifndef HENHOUSE_EVENTS_H
+#define HENHOUSE_EVENTS_H
+
+#include "db/types.hpp"
+#include "util/dbc.hpp"
+#include "util/mapped_vector.hpp"
+
+#include <algorithm>
+
+namespace henhouse::db
+{
+    struct events_item
+    {
+        count_type count;       //puts into the bucket
+        count_type integral;    //puts up to and including the bucket
+    };
+
+    struct events_metadata
+    {
+        std::size_t size = 0;
+    };
+
+    using events_data = util::mapped_vector<events_metadata, events_item>;
+
+    const std::size_t EVENTS_SIZE = util::PAGE_SIZE;
+
+    /**
+     * Counts of put operations per bucket and their prefix sums, kept aligned with
+     * the positions of the timeline data.
+     *
+     * This interface is NOT thread safe.
+     */
+    class events_index
+    {
+        public:
+            events_index() {}
+            events_index(const boost::filesystem::path& file) : _data{file, EVENTS_SIZE} {}
+
+            //appends buckets without events until there are size items
+            void grow(offset_type size)
+            {
+                while(_data.size() < size)
+                {
+                    const auto integral = _data.empty() ? 0 : _data.back().integral;
+                    _data.push_back(events_item{0, integral});
+                }
+
+                ENSURE_GREATER_EQUAL(_data.size(), size);
+            }
+
+            //counts a put into the bucket at pos
+            void record(offset_type pos)
+            {
+                REQUIRE_LESS(pos, _data.size());
+
+                //puts only happen within the late write window so this is bounded
+                _data[pos].count++;
+                for(auto p = pos; p < _data.size(); p++)
+                    _data[p].integral++;
+            }
+
+            //puts between positions l and r inclusive.
+            count_type range(offset_type l, offset_type r) const
+            {
+                REQUIRE_LESS_EQUAL(l, r);
+                REQUIRE_LESS(r, _data.size());
+
+                const auto prev = l > 0 ? _data[l - 1].integral : 0;
+                return _data[r].integral - prev;
+            }
+
+            std::size_t size() const { return _data.size(); }
+
+            //releases the disk space of the items before pos
+            void release_front(offset_type pos) { _data.release_front(std::min<offset_type>(pos, _data.size())); }
+
+            void unmap() { _data.unmap(); }
+            void map() { _data.map(); }
+
+        private:
+            events_data _data;
+    };
+}
+#endif
@@ -0,0 +1,168 @@
+#ifndef HENHOUSE_EXTREMA_H
+#define HENHOUSE_EXTREMA_H
+
+#include "db/types.hpp"
+#include "util/dbc.hpp"
+#include "util/mapped_vector.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace henhouse::db
+{
+    struct extrema_item
+    {
+        count_type min;
+        count_type max;
+    };
+
+    struct extrema_metadata
+    {
+        std::size_t size = 0;
+    };
+
+    using extrema_blocks = util::mapped_vector<extrema_metadata, extrema_item>;
+
+    const offset_type EXTREMA_BLOCK = 128;
+    const std::size_t EXTREMA_SIZE = util::PAGE_SIZE;
+
+    inline extrema_item combine(const extrema_item& a, const extrema_item& b)
+    {
+        return extrema_item{std::min(a.min, b.min), std::max(a.max, b.max)};
+    }
+
+    /**
+     * Answers the min and max of bucket values over any range of positions.
+     *
+     * The min and max of each sealed block of EXTREMA_BLOCK buckets is stored on disk.
+     * Blocks are only added once all their buckets are sealed so they never change.
+     * A sparse table over the blocks is built in memory on the first query and
+     * extended as new blocks are sealed.
+     *
+     * A query scans the partial blocks at the edges of the range, and the unsealed tail,
+     * and combines two overlapping power of two runs of blocks for everything in between.
+     * The scans are bounded by the block size and late write window so queries
+     * are constant time.
+     *
+     * This interface is NOT thread safe.
+     */
+    class extrema_index
+    {
+        public:
+            extrema_index() {}
+            extrema_index(const boost::filesystem::path& file) : _blocks{file, EXTREMA_SIZE} {}
+
+            //append the blocks that are within the first sealed positions of data
+            template <class items>
+                void seal(const items& data, const offset_type sealed)
+                {
+                    REQUIRE_LESS_EQUAL(sealed, data.size());
+
+                    while((_blocks.size() + 1) * EXTREMA_BLOCK <= sealed)
+                    {
+                        const auto first = _blocks.size() * EXTREMA_BLOCK;
+                        _blocks.push_back(scan(data, first, first + EXTREMA_BLOCK - 1));
+                    }
+                }
+
+            //min and max of values between positions l and r inclusive.
+            template <class items>
+                extrema_item range(const items& data, const offset_type l, const offset_type r) const
+                {
+                    REQUIRE_LESS_EQUAL(l, r);
+                    REQUIRE_LESS(r, data.size());
+
+                    //whole blocks within range
+                    const auto first = (l + EXTREMA_BLOCK - 1) / EXTREMA_BLOCK;
+                    const auto last = std::min<offset_type>((r + 1) / EXTREMA_BLOCK, _blocks.size());
+
+                    if(first >= last) return scan(data, l, r);
+
+                    auto e = query_blocks(first, last - 1);
+
+                    const auto block_start = first * EXTREMA_BLOCK;
+                    const auto block_end = last * EXTREMA_BLOCK;
+
+                    if(l < block_start) e = combine(e, scan(data, l, block_start - 1));
+                    if(block_end <= r) e = combine(e, scan(data, block_end, r));
+
+                    return e;
+                }
+
+            std::size_t blocks() const { return _blocks.size(); }
+
+            //releases the disk space of blocks ending before position pos
+            void release_front(offset_type pos) 
+            { 
+                _blocks.release_front(std::min<offset_type>(pos / EXTREMA_BLOCK, _blocks.size()));
+            }
+
+            void unmap() { _blocks.unmap(); }
+            void map() { _blocks.map(); }
+
+        private:
+            template <class items>
+                static extrema_item scan(const items& data, const offset_type l, const offset_type r)
+                {
+                    REQUIRE_LESS_EQUAL(l, r);
+                    REQUIRE_LESS(r, data.size());
+
+                    extrema_item e{data[l].value, data[l].value};
+                    for(auto p = l + 1; p <= r; p++)
+                    {
+                        const auto v = data[p].value;
+                        e.min = std::min(e.min, v);
+                        e.max = std::max(e.max, v);
+                    }
+                    return e;
+                }
+
+            //level k of the sparse table covers 2^k blocks starting at block i.
+            const extrema_item& table(const std::size_t k, const std::size_t i) const
+            {
+                if(k == 0) return _blocks[i];
+
+                REQUIRE_LESS_EQUAL(k, _table.size());
+                REQUIRE_LESS(i, _table[k-1].size());
+                return _table[k-1][i];
+            }
+
+            //extends each level of the table to cover the newly sealed blocks.
+            void extend_table() const
+            {
+                const auto n = _blocks.size();
+
+                for(std::size_t k = 1; (std::size_t{1} << k) <= n; k++)
+                {
+                    if(_table.size() < k) _table.emplace_back();
+
+                    auto& level = _table[k-1];
+                    const auto half = std::size_t{1} << (k - 1);
+                    const auto size = n - (std::size_t{1} << k) + 1;
+
+                    for(auto i = level.size(); i < size; i++)
+                        level.push_back(combine(table(k-1, i), table(k-1, i + half)));
+                }
+            }
+
+            //min and max of blocks first to last inclusive
+            extrema_item query_blocks(const std::size_t first, const std::size_t last) const
+            {
+                REQUIRE_LESS_EQUAL(first, last);
+                REQUIRE_LESS(last, _blocks.size());
+
+                extend_table();
+
+                std::size_t k = 0;
+                const auto n = last - first + 1;
+                while((std::size_t{1} << (k + 1)) <= n) k++;
+
+                return combine(table(k, first), table(k, last + 1 - (std::size_t{1} << k)));
+            }
+
+        private:
+            extrema_blocks _blocks;
+            mutable std::vector<std::vector<extrema_item>> _table;
+    };
+}
+#endif
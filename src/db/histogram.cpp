@@ -0,0 +1,96 @@
+#include "db/histogram.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace henhouse::db
+{
+    std::size_t histogram_bin(count_type v)
+    {
+        if(v < 1) return 0;
+
+        const auto b = static_cast<std::size_t>(std::floor(2.0 * std::log2(static_cast<double>(v)))) + 1;
+        return std::min(b, HISTOGRAM_BINS - 1);
+    }
+
+    double bin_lower(std::size_t bin)
+    {
+        REQUIRE_LESS(bin, HISTOGRAM_BINS);
+        return bin == 0 ? 0.0 : std::exp2((bin - 1) / 2.0);
+    }
+
+    double bin_upper(std::size_t bin)
+    {
+        REQUIRE_LESS(bin, HISTOGRAM_BINS);
+        return std::exp2(bin / 2.0);
+    }
+
+    count_type observations(const histogram_bins& h)
+    {
+        count_type n = 0;
+        for(auto c : h) n += c;
+        return n;
+    }
+
+    double quantile(const histogram_bins& h, double q)
+    {
+        REQUIRE_GREATER_EQUAL(q, 0.0);
+        REQUIRE_LESS_EQUAL(q, 1.0);
+
+        const auto n = observations(h);
+        if(n == 0) return 0.0;
+
+        const auto rank = q * n;
+        count_type seen = 0;
+
+        for(std::size_t b = 0; b < HISTOGRAM_BINS; b++)
+        {
+            if(h[b] == 0) continue;
+            if(seen + h[b] >= rank)
+            {
+                const auto fraction = (rank - seen) / h[b];
+                return bin_lower(b) + fraction * (bin_upper(b) - bin_lower(b));
+            }
+            seen += h[b];
+        }
+
+        return bin_upper(HISTOGRAM_BINS - 1);
+    }
+
+    void histogram_index::grow(offset_type size)
+    {
+        while(_data.size() < size)
+        {
+            const auto prev = _data.empty() ? histogram_item{} : _data.back();
+            _data.push_back(prev);
+        }
+
+        ENSURE_GREATER_EQUAL(_data.size(), size);
+    }
+
+    void histogram_index::observe(offset_type pos, count_type v)
+    {
+        REQUIRE_LESS(pos, _data.size());
+
+        //puts only happen within the late write window so this is bounded
+        const auto bin = histogram_bin(v);
+        for(auto p = pos; p < _data.size(); p++)
+            _data[p].integral[bin]++;
+    }
+
+    histogram_bins histogram_index::range(offset_type l, offset_type r) const
+    {
+        REQUIRE_LESS_EQUAL(l, r);
+        REQUIRE_LESS(r, _data.size());
+
+        auto h = _data[r].integral;
+        if(l == 0) return h;
+
+        const auto& prev = _data[l - 1].integral;
+        for(std::size_t b = 0; b < HISTOGRAM_BINS; b++)
+            h[b] -= prev[b];
+
+        return h;
+    }
+}
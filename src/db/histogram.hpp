@@ -0,0 +1,80 @@
+#ifndef HENHOUSE_HISTOGRAM_H
+#define HENHOUSE_HISTOGRAM_H
+
+#include "db/types.hpp"
+#include "util/mapped_vector.hpp"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+
+namespace henhouse::db
+{
+    /**
+     * Observations are counted in fixed log scaled bins. Bin 0 holds values
+     * less than 1 and bin i holds values in [2^((i-1)/2), 2^(i/2)). The last bin
+     * holds everything larger.
+     */
+    const std::size_t HISTOGRAM_BINS = 64;
+
+    using histogram_bins = std::array<count_type, HISTOGRAM_BINS>;
+    using histogram_ptr = std::shared_ptr<const histogram_bins>;
+
+    //each item holds the count of observations per bin up to and including its bucket
+    struct histogram_item
+    {
+        histogram_bins integral;
+    };
+
+    struct histogram_metadata
+    {
+        std::size_t size = 0;
+    };
+
+    using histogram_data = util::mapped_vector<histogram_metadata, histogram_item>;
+
+    const std::size_t HISTOGRAM_SIZE = util::PAGE_SIZE * 16;
+
+    std::size_t histogram_bin(count_type v);
+    double bin_lower(std::size_t bin);
+    double bin_upper(std::size_t bin);
+
+    //estimates the q quantile by interpolating within the bin it falls in
+    double quantile(const histogram_bins& h, double q);
+    count_type observations(const histogram_bins& h);
+
+    /**
+     * Per bin prefix sums of observations kept aligned with the positions of the
+     * timeline data. The distribution of any range of buckets is the difference
+     * of two items.
+     *
+     * This interface is NOT thread safe.
+     */
+    class histogram_index
+    {
+        public:
+            histogram_index() {}
+            histogram_index(const boost::filesystem::path& file) : _data{file, HISTOGRAM_SIZE} {}
+
+            //appends items without new observations until there are size items
+            void grow(offset_type size);
+
+            //adds an observation of v to the bucket at pos and the prefix sums after it
+            void observe(offset_type pos, count_type v);
+
+            //observations per bin between positions l and r inclusive.
+            histogram_bins range(offset_type l, offset_type r) const;
+
+            std::size_t size() const { return _data.size(); }
+
+            //releases the disk space of the items before pos
+            void release_front(offset_type pos) { _data.release_front(std::min<offset_type>(pos, _data.size())); }
+
+            void unmap() { _data.unmap(); }
+            void map() { _data.map(); }
+
+        private:
+            histogram_data _data;
+    };
+}
+#endif
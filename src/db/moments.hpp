@@ -0,0 +1,108 @@
+#ifndef HENHOUSE_MOMENTS_H
+#define HENHOUSE_MOMENTS_H
+
+#include "db/types.hpp"
+#include "util/dbc.hpp"
+#include "util/mapped_vector.hpp"
+
+#include <algorithm>
+
+namespace henhouse::db
+{
+    //prefix sums wrap around so they are unsigned, where overflow is defined
+    using moment_sum = unsigned __int128;
+
+    //sums of third and fourth powers up to and including a bucket, modulo 2^128
+    struct moments_item
+    {
+        moment_sum third_integral;
+        moment_sum fourth_integral;
+    };
+
+    //sums of third and fourth powers of a range of buckets
+    struct moments_range
+    {
+        wide_count_type third_integral;
+        wide_count_type fourth_integral;
+    };
+
+    struct moments_metadata
+    {
+        std::size_t size = 0;
+    };
+
+    using moments_data = util::mapped_vector<moments_metadata, moments_item>;
+
+    const std::size_t MOMENTS_SIZE = util::PAGE_SIZE;
+
+    /**
+     * Third and fourth power prefix sums of bucket values kept aligned with the
+     * positions of the timeline data. The prefix sums may wrap around but the 
+     * difference of two is still exact as long as the sums of the range fit in
+     * 128 bits. Since the sum of fourth powers is at most the square of the sum 
+     * of squares, that holds for any range whose 64 bit sum of squares in the 
+     * timeline data didn't overflow, so moments are exact whenever variance is.
+     *
+     * This interface is NOT thread safe.
+     */
+    class moments_index
+    {
+        public:
+            moments_index() {}
+            moments_index(const boost::filesystem::path& file) : _data{file, MOMENTS_SIZE} {}
+
+            //recomputes the prefix sums from position pos to the end of the data
+            template <class items>
+                void update(const items& data, offset_type pos)
+                {
+                    pos = std::min<offset_type>(pos, _data.size());
+
+                    for(auto p = pos; p < data.size(); p++)
+                    {
+                        //negative values wrap to their two's complement, which sums correctly
+                        const auto v = static_cast<moment_sum>(static_cast<wide_count_type>(data[p].value));
+                        const auto v2 = v * v;
+
+                        auto m = p > 0 ? _data[p - 1] : moments_item{0, 0};
+                        m.third_integral += v2 * v;
+                        m.fourth_integral += v2 * v2;
+
+                        if(p < _data.size()) _data[p] = m;
+                        else _data.push_back(m);
+                    }
+
+                    ENSURE_EQUAL(_data.size(), data.size());
+                }
+
+            //sums of third and fourth powers between positions l and r inclusive.
+            moments_range range(offset_type l, offset_type r) const
+            {
+                REQUIRE_LESS_EQUAL(l, r);
+                REQUIRE_LESS(r, _data.size());
+
+                auto m = _data[r];
+                if(l > 0)
+                {
+                    const auto& prev = _data[l - 1];
+                    m.third_integral -= prev.third_integral;
+                    m.fourth_integral -= prev.fourth_integral;
+                }
+
+                return moments_range{
+                    static_cast<wide_count_type>(m.third_integral), 
+                    static_cast<wide_count_type>(m.fourth_integral)};
+            }
+
+            std::size_t size() const { return _data.size(); }
+
+            //releases the disk space of the items before pos
+            void release_front(offset_type pos) { _data.release_front(std::min<offset_type>(pos, _data.size())); }
+
+            void unmap() { _data.unmap(); }
+            void map() { _data.map(); }
+
+        private:
+            moments_data _data;
+    };
+}
+#endif
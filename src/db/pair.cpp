@@ -0,0 +1,118 @@
+#include "db/pair.hpp"
+
+#include <cmath>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::db
+{
+    namespace
+    {
+        //computes the sums of the current bucket from the previous bucket
+        void propogate(const pair_item& prev, pair_item& current)
+        {
+            const wide_count_type x = current.x;
+            const wide_count_type y = current.y;
+            current.x_integral = prev.x_integral + x;
+            current.y_integral = prev.y_integral + y;
+            current.xx_integral = prev.xx_integral + (x * x);
+            current.yy_integral = prev.yy_integral + (y * y);
+            current.xy_integral = prev.xy_integral + (x * y);
+        }
+
+        const pair_item EMPTY_PAIR_ITEM = {0, 0, 0, 0, 0, 0, 0};
+    }
+
+    bool pair_timeline::put(time_type t, pair_side side, count_type c)
+    {
+        put_pos p;
+        if(!index.find_put_pos(t, data.size(), ADD_BUCKET_BACK_LIMIT, p)) return false;
+
+        if(p.pos == data.size()) data.push_back(EMPTY_PAIR_ITEM);
+
+        auto& current = data[p.pos];
+        if(side == pair_side::x) current.x += c;
+        else current.y += c;
+
+        for(auto i = p.pos; i < data.size(); i++)
+            propogate(i > 0 ? data[i-1] : EMPTY_PAIR_ITEM, data[i]);
+
+        if(p.new_range) index.push_back(p.range);
+        return true;
+    }
+
+    /**
+     * Covariance and correlation are computed from the sums like variance is
+     *
+     * cov(x, y) = sum(x y) / N - mean(x) mean(y)
+     * corr(x, y) = cov(x, y) / sqrt(var(x) var(y))
+     *
+     * Buckets without data count as zero.
+     */
+    corr_result pair_timeline::corr(time_type a, time_type b) const
+    {
+        const auto resolution = index.meta().resolution;
+        CHECK_GREATER(resolution, 0);
+
+        if(a > b) std::swap(a, b);
+        if(data.empty()) return corr_result{a, b, resolution, 0, 0, 0, 0, 0};
+
+        auto pa = index.find_pos(a, 0);
+        auto pb = index.find_pos(b, 0);
+        clamp(pa, data.size());
+        clamp(pb, data.size());
+
+        // zero out data before beginning of collection
+        const auto ia = a < pa.time ? EMPTY_PAIR_ITEM : data[pa.pos + pa.offset];
+        const auto ib = b < pb.time ? EMPTY_PAIR_ITEM : data[pb.pos + pb.offset];
+
+        const auto front = index.front().time;
+        const count_type n =
+            (bucket_time(b, front, resolution) - bucket_time(a, front, resolution)) / resolution;
+
+        if(n == 0) return corr_result{a, b, resolution, 0, 0, 0, 0, 0};
+
+        using wide_mean = long double;
+        const wide_mean mean_x = static_cast<wide_mean>(ib.x_integral - ia.x_integral) / n;
+        const wide_mean mean_y = static_cast<wide_mean>(ib.y_integral - ia.y_integral) / n;
+        const wide_mean xx = static_cast<wide_mean>(ib.xx_integral - ia.xx_integral) / n;
+        const wide_mean yy = static_cast<wide_mean>(ib.yy_integral - ia.yy_integral) / n;
+        const wide_mean xy = static_cast<wide_mean>(ib.xy_integral - ia.xy_integral) / n;
+
+        const auto var_x = xx - mean_x * mean_x;
+        const auto var_y = yy - mean_y * mean_y;
+        const auto covariance = xy - mean_x * mean_y;
+        const auto correlation = var_x > 0 && var_y > 0 ? covariance / std::sqrt(var_x * var_y) : 0;
+
+        return corr_result
+        {
+            a,
+            b,
+            resolution,
+            n,
+            static_cast<mean_type>(mean_x),
+            static_cast<mean_type>(mean_y),
+            static_cast<mean_type>(covariance),
+            static_cast<mean_type>(correlation)
+        };
+    }
+
+    pair_timeline pair_from_directory(const std::string& path, const time_type resolution)
+    {
+        REQUIRE(!path.empty());
+        REQUIRE_GREATER(resolution, 0);
+
+        fs::create_directories(path);
+        if(!fs::is_directory(path))
+            throw std::runtime_error{"path " + path + " is not a directory"};
+
+        fs::path root = path;
+
+        pair_timeline t;
+        t.index = std::move(index_type{root / "_.i", resolution});
+        t.data = std::move(pair_data{root / "_.p", PAIR_DATA_SIZE});
+
+        return t;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef HENHOUSE_PAIR_H
+#define HENHOUSE_PAIR_H
+
+#include "db/timeline.hpp"
+
+#include <string>
+
+namespace henhouse::db
+{
+    enum class pair_side { x, y };
+
+    /**
+     * A bucket of a pair timeline has the values of both keys along with
+     * sums up to that bucket of the values, their squares, and their product.
+     */
+    struct pair_item
+    {
+        count_type x;
+        count_type y;
+        wide_count_type x_integral;
+        wide_count_type y_integral;
+        wide_count_type xx_integral;
+        wide_count_type yy_integral;
+        wide_count_type xy_integral;
+    };
+
+    struct pair_metadata
+    {
+        std::size_t size = 0;
+    };
+
+    using pair_data = util::mapped_vector<pair_metadata, pair_item>;
+
+    const std::size_t PAIR_DATA_SIZE = util::PAGE_SIZE;
+
+    struct corr_result
+    {
+        time_type a;                //request from time
+        time_type b;                //request to time
+        time_type resolution;       //resolution of buckets
+        count_type size;            //buckets within time range
+        mean_type mean_x;           //mean of x within time range
+        mean_type mean_y;           //mean of y within time range
+        mean_type covariance;       //covariance of x and y within time range
+        mean_type correlation;      //pearson correlation of x and y within time range
+    };
+
+    /**
+     * Timeline of two keys aligned on bucket. It is indexed the same way as a timeline
+     * and has the same restrictions on puts, but each put only changes one side.
+     *
+     * This interface is NOT thread safe.
+     */
+    struct pair_timeline
+    {
+        index_type index;
+        pair_data data;
+
+        bool put(time_type t, pair_side side, count_type c);
+        corr_result corr(time_type a, time_type b) const;
+    };
+
+    pair_timeline pair_from_directory(const std::string& path, const time_type resolution);
+}
+#endif
@@ -0,0 +1,130 @@
+#ifndef HENHOUSE_ROLLUP_H
+#define HENHOUSE_ROLLUP_H
+
+#include "db/types.hpp"
+#include "util/dbc.hpp"
+#include "util/mapped_vector.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace henhouse::db
+{
+    /**
+     * A bucket of a rollup has the sum of the timeline buckets rolled into it
+     * and the sum of their squares, along with prefix sums of both. Since the
+     * squares are of the timeline buckets, variance from a rollup is the same
+     * as variance from the timeline.
+     */
+    struct rollup_item
+    {
+        count_type value;
+        count_type square;
+        count_type integral;
+        count_type second_integral;
+    };
+
+    struct rollup_metadata
+    {
+        std::size_t size = 0;
+        time_type resolution = 0;
+        time_type front = 0;        //time of the first bucket
+    };
+
+    using rollup_data = util::mapped_vector<rollup_metadata, rollup_item>;
+    using rollup_resolutions = std::vector<time_type>;
+
+    const std::size_t ROLLUP_SIZE = util::PAGE_SIZE;
+
+    /**
+     * Timeline downsampled to a coarser resolution. Buckets are aligned to multiples
+     * of the resolution and stored without gaps so the bucket of a time is found
+     * without an index search. A timeline bucket starting at s is rolled into the
+     * bucket at s rounded up to the resolution, so a rollup diff between two aligned
+     * times covers the same timeline buckets as a timeline diff does.
+     *
+     * This interface is NOT thread safe.
+     */
+    class rollup_index
+    {
+        public:
+            rollup_index() {}
+            rollup_index(const boost::filesystem::path& file, const time_type resolution) :
+                _data{file, ROLLUP_SIZE}
+            {
+                REQUIRE_GREATER(resolution, 0);
+                if(_data.meta().resolution == 0) _data.meta().resolution = resolution;
+            }
+
+            time_type resolution() const { return _data.meta().resolution; }
+            time_type front() const { return _data.meta().front; }
+
+            //time of the bucket the timeline bucket starting at s rolls into
+            time_type bucket(time_type s) const
+            {
+                const auto r = resolution();
+                return ((s + r - 1) / r) * r;
+            }
+
+            /**
+             * Adds c to the bucket of the timeline bucket starting at s where square
+             * is the change of the square of that timeline bucket.
+             */
+            void add(time_type s, count_type c, count_type square)
+            {
+                const auto t = bucket(s);
+                if(_data.empty()) _data.meta().front = t;
+
+                REQUIRE_GREATER_EQUAL(t, front());
+                const auto pos = (t - front()) / resolution();
+
+                while(_data.size() <= pos)
+                {
+                    const auto prev = _data.empty() ? rollup_item{0, 0, 0, 0} : _data.back();
+                    _data.push_back(rollup_item{0, 0, prev.integral, prev.second_integral});
+                }
+
+                _data[pos].value += c;
+                _data[pos].square += square;
+
+                //puts only happen within the late write window so this is bounded
+                for(auto p = pos; p < _data.size(); p++)
+                {
+                    _data[p].integral += c;
+                    _data[p].second_integral += square;
+                }
+            }
+
+            //bucket containing time t. Times before the first bucket are empty.
+            rollup_item get(time_type t) const
+            {
+                if(_data.empty() || t < front()) return rollup_item{0, 0, 0, 0};
+
+                const auto pos = std::min<offset_type>((t - front()) / resolution(), _data.size() - 1);
+                return _data[pos];
+            }
+
+            const rollup_item* last() const { return _data.empty() ? nullptr : &_data.back();}
+
+            void clear() { _data.meta().size = 0; }
+
+            /**
+             * Releases the disk space of buckets before the one containing time t.
+             * Those read as zero afterwards, so get must not be asked for them.
+             */
+            void release_before(time_type t)
+            {
+                if(_data.empty() || t <= front()) return;
+                _data.release_front(std::min<offset_type>((t - front()) / resolution(), _data.size()));
+            }
+
+            void unmap() { _data.unmap(); }
+            void map() { _data.map(); }
+
+        private:
+            rollup_data _data;
+    };
+
+    using rollup_indexes = std::vector<rollup_index>;
+}
+#endif
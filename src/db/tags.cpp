@@ -0,0 +1,383 @@
+#include "db/tags.hpp"
+#include "db/db.hpp"
+
+#include <cctype>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <boost/regex.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace henhouse::db
+{
+    namespace
+    {
+        const std::string TAGS_FILE = ".tags";
+        const std::string NAME_TAG = "name";
+        const stde::string_view SERIES_BY_TAG = "seriesByTag(";
+
+        stde::string_view trim(stde::string_view s)
+        {
+            while(!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+            while(!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
+            return s;
+        }
+
+        tag_expr parse_tag_expr(const stde::string_view& e)
+        {
+            const auto op = e.find_first_of("!=");
+            if(op == stde::string_view::npos || op == 0)
+                throw std::invalid_argument{"tag expression " + e.to_string() + " must be written as tag=value"};
+
+            tag_expr r;
+            r.tag = e.substr(0, op).to_string();
+
+            auto rest = e.substr(op);
+            if(rest.substr(0, 3) == "!=~") { r.op = tag_op::not_match; rest.remove_prefix(3);}
+            else if(rest.substr(0, 2) == "!=") { r.op = tag_op::not_equal; rest.remove_prefix(2);}
+            else if(rest.substr(0, 2) == "=~") { r.op = tag_op::match; rest.remove_prefix(2);}
+            else if(rest.substr(0, 1) == "=") { r.op = tag_op::equal; rest.remove_prefix(1);}
+            else throw std::invalid_argument{"tag expression " + e.to_string() + " has an unknown operator"};
+
+            r.value = rest.to_string();
+            return r;
+        }
+
+        boost::regex compile(const std::string& pattern)
+        try
+        {
+            return boost::regex{pattern};
+        }
+        catch(boost::regex_error& e)
+        {
+            throw std::invalid_argument{"tag regex " + pattern + " is invalid: " + e.what()};
+        }
+
+        //graphite matches tag regexes from the start of the value
+        bool regex_matches(const boost::regex& re, const std::string& v)
+        {
+            return boost::regex_search(v, re, boost::match_continuous);
+        }
+
+        //value of the tag, empty if the series doesn't have it
+        const std::string& tag_value(const tagged_series& s, const std::string& tag)
+        {
+            static const std::string none;
+            if(tag == NAME_TAG) return s.name;
+
+            const auto t = std::lower_bound(std::begin(s.tags), std::end(s.tags), tag,
+                    [](const db::tag& a, const std::string& b) { return a.name < b;});
+
+            return t != std::end(s.tags) && t->name == tag ? t->value : none;
+        }
+
+        bool matches(const tagged_series& s, const tag_expr& e, const boost::regex* re)
+        {
+            const auto& v = tag_value(s, e.tag);
+            switch(e.op)
+            {
+                case tag_op::equal: return v == e.value;
+                case tag_op::not_equal: return v != e.value;
+                case tag_op::match: CHECK(re); return regex_matches(*re, v);
+                case tag_op::not_match: CHECK(re); return !regex_matches(*re, v);
+            }
+            return false;
+        }
+    }
+
+    bool is_tagged(const stde::string_view& key)
+    {
+        return key.find(';') != stde::string_view::npos;
+    }
+
+    bool parse_tagged(const stde::string_view& key, tagged_series& s)
+    {
+        auto end = key.find(';');
+        if(end == 0 || end == stde::string_view::npos) return false;
+
+        s.name = key.substr(0, end).to_string();
+        s.tags.clear();
+
+        while(end != stde::string_view::npos)
+        {
+            const auto start = end + 1;
+            end = key.find(';', start);
+
+            const auto t = key.substr(start, end == stde::string_view::npos ? end : end - start);
+            const auto eq = t.find('=');
+            if(eq == 0 || eq == stde::string_view::npos || eq + 1 == t.size()) return false;
+
+            tag r{t.substr(0, eq).to_string(), t.substr(eq + 1).to_string()};
+            if(r.name == NAME_TAG) return false;
+
+            s.tags.emplace_back(std::move(r));
+        }
+
+        std::sort(std::begin(s.tags), std::end(s.tags),
+                [](const tag& a, const tag& b) { return a.name < b.name;});
+
+        const auto dup = std::adjacent_find(std::begin(s.tags), std::end(s.tags),
+                [](const tag& a, const tag& b) { return a.name == b.name;});
+
+        return dup == std::end(s.tags);
+    }
+
+    bool parse_series_by_tag(const stde::string_view& call, tag_exprs& exprs)
+    {
+        auto s = trim(call);
+        if(s.substr(0, SERIES_BY_TAG.size()) != SERIES_BY_TAG) return false;
+
+        if(s.back() != ')')
+            throw std::invalid_argument{"seriesByTag must end with a )"};
+
+        s = s.substr(SERIES_BY_TAG.size(), s.size() - SERIES_BY_TAG.size() - 1);
+
+        exprs.clear();
+
+        //commas within quotes are part of the expression, like in a regex
+        char quote = 0;
+        std::size_t start = 0;
+        for(std::size_t i = 0; i <= s.size(); i++)
+        {
+            if(i < s.size() && quote != 0)
+            {
+                if(s[i] == quote) quote = 0;
+                continue;
+            }
+
+            if(i < s.size() && (s[i] == '\'' || s[i] == '"')) { quote = s[i]; continue;}
+            if(i < s.size() && s[i] != ',') continue;
+
+            auto e = trim(s.substr(start, i - start));
+            if(e.size() >= 2 && (e.front() == '\'' || e.front() == '"') && e.back() == e.front())
+                e = e.substr(1, e.size() - 2);
+
+            if(e.empty()) throw std::invalid_argument{"seriesByTag has an empty expression"};
+
+            exprs.emplace_back(parse_tag_expr(e));
+            start = i + 1;
+        }
+
+        if(quote != 0) throw std::invalid_argument{"seriesByTag has an unclosed quote"};
+
+        ENSURE_FALSE(exprs.empty());
+        return true;
+    }
+
+    series_ids intersect(std::vector<const posting_list*> lists, std::size_t max)
+    {
+        REQUIRE_FALSE(lists.empty());
+
+        std::sort(std::begin(lists), std::end(lists),
+                [](const posting_list* a, const posting_list* b) { return a->size() < b->size();});
+
+        std::vector<posting_list::cursor> cursors;
+        cursors.reserve(lists.size());
+        for(const auto l : lists) cursors.emplace_back(*l);
+
+        series_ids ids;
+        auto& lead = cursors.front();
+        while(!lead.done() && ids.size() < max)
+        {
+            const auto id = lead.value();
+
+            std::size_t i = 1;
+            for(; i < cursors.size(); i++)
+            {
+                cursors[i].seek(id);
+                if(cursors[i].done()) return ids;
+                if(cursors[i].value() != id) break;
+            }
+
+            if(i == cursors.size())
+            {
+                ids.push_back(id);
+                lead.next();
+            }
+            else lead.seek(cursors[i].value());
+        }
+
+        ENSURE_LESS_EQUAL(ids.size(), max);
+        return ids;
+    }
+
+    tag_index::tag_index(const fs::path& root) : _log_file{root / TAGS_FILE}
+    {
+        REQUIRE(!root.empty());
+
+        if(fs::exists(_log_file)) load();
+
+        _log.open(_log_file.string(), std::ios::out | std::ios::app);
+        if(!_log) throw std::runtime_error{"unable to open tag index " + _log_file.string()};
+    }
+
+    //series are indexed in the order they were logged so they get the same ids
+    void tag_index::load()
+    {
+        std::ifstream in{_log_file.string()};
+        std::string key;
+        tagged_series s;
+        while(std::getline(in, key))
+            if(parse_tagged(key, s) && _ids.find(key) == std::end(_ids)) index(key, s);
+    }
+
+    void tag_index::index(const std::string& key, const tagged_series& s)
+    {
+        REQUIRE_LESS(_series.size(), std::numeric_limits<series_id>::max());
+
+        const auto id = static_cast<series_id>(_series.size());
+        const auto r = _ids.emplace(key, id);
+        _series.push_back(&r.first->first);
+
+        _postings[NAME_TAG][s.name].add(id);
+        for(const auto& t : s.tags)
+            _postings[t.name][t.value].add(id);
+    }
+
+    //a hash lookup of a copy of the key is several times faster than searching a sorted map by view
+    void tag_index::add(const stde::string_view& key)
+    {
+        REQUIRE_FALSE(key.empty());
+
+        const auto k = key.to_string();
+        if(contains(k)) return;
+
+        tagged_series s;
+        if(!parse_tagged(key, s)) return;
+
+        std::unique_lock<std::shared_mutex> lock{_mutex};
+        if(_ids.find(k) != std::end(_ids)) return;
+
+        index(k, s);
+
+        _log << *_series.back() << '\n';
+        _log.flush();
+    }
+
+    bool tag_index::contains(const std::string& key) const
+    {
+        std::shared_lock<std::shared_mutex> lock{_mutex};
+        return _ids.find(key) != std::end(_ids);
+    }
+
+    std::size_t tag_index::size() const
+    {
+        std::shared_lock<std::shared_mutex> lock{_mutex};
+        return _series.size();
+    }
+
+    const posting_list* tag_index::postings(const std::string& tag, const std::string& value) const
+    {
+        const auto t = _postings.find(tag);
+        if(t == std::end(_postings)) return nullptr;
+
+        const auto v = t->second.find(value);
+        return v == std::end(t->second) ? nullptr : &v->second;
+    }
+
+    key_list tag_index::find(const tag_exprs& exprs, std::size_t max) const
+    {
+        REQUIRE_GREATER(max, 0);
+
+        std::vector<boost::regex> regexes(exprs.size());
+        std::vector<std::size_t> filters;
+        std::vector<std::size_t> equals;
+        std::vector<std::size_t> not_equals;
+        std::size_t lead_match = exprs.size();
+
+        for(std::size_t i = 0; i < exprs.size(); i++)
+        {
+            const auto& e = exprs[i];
+            if(e.op == tag_op::match || e.op == tag_op::not_match) regexes[i] = compile(e.value);
+
+            if(e.op == tag_op::equal && !e.value.empty()) equals.push_back(i);
+            else if(e.op == tag_op::not_equal && !e.value.empty()) not_equals.push_back(i);
+            else
+            {
+                filters.push_back(i);
+                if(e.op == tag_op::match && !e.value.empty() && lead_match == exprs.size()) lead_match = i;
+            }
+        }
+
+        if(equals.empty() && lead_match == exprs.size())
+            throw std::invalid_argument{"seriesByTag needs a tag=value or tag=~regex expression with a value"};
+
+        std::shared_lock<std::shared_mutex> lock{_mutex};
+
+        series_ids ids;
+        if(!equals.empty())
+        {
+            std::vector<const posting_list*> lists;
+            for(const auto i : equals)
+            {
+                const auto p = postings(exprs[i].tag, exprs[i].value);
+                if(p == nullptr) return {};
+                lists.push_back(p);
+            }
+
+            //filtered ids can't stop early since some of them may not match
+            const bool filtered = !filters.empty() || !not_equals.empty();
+            ids = intersect(std::move(lists), filtered ? std::numeric_limits<std::size_t>::max() : max);
+        }
+        else
+        {
+            //union of the values of the tag matching the regex
+            const auto& e = exprs[lead_match];
+            const auto t = _postings.find(e.tag);
+            if(t == std::end(_postings)) return {};
+
+            for(const auto& v : t->second)
+            {
+                if(!regex_matches(regexes[lead_match], v.first)) continue;
+                for(posting_list::cursor c{v.second}; !c.done(); c.next()) ids.push_back(c.value());
+            }
+
+            std::sort(std::begin(ids), std::end(ids));
+        }
+
+        //series with the value of a not equal are skipped by walking its postings along with the ids
+        std::vector<posting_list::cursor> excluded;
+        for(const auto i : not_equals)
+        {
+            const auto p = postings(exprs[i].tag, exprs[i].value);
+            if(p != nullptr) excluded.emplace_back(*p);
+        }
+
+        key_list keys;
+        std::unordered_set<std::string> seen;
+        std::string key;
+        tagged_series s;
+        for(const auto id : ids)
+        {
+            if(keys.size() == max) break;
+
+            const bool skip = std::any_of(std::begin(excluded), std::end(excluded),
+                    [id](posting_list::cursor& c) 
+                    { 
+                        c.seek(id); 
+                        return !c.done() && c.value() == id;
+                    });
+
+            if(skip) continue;
+
+            const auto& name = *_series[id];
+            if(!filters.empty())
+            {
+                parse_tagged(name, s);
+
+                const bool all = std::all_of(std::begin(filters), std::end(filters),
+                        [&](std::size_t i) { return matches(s, exprs[i], &regexes[i]);});
+
+                if(!all) continue;
+            }
+
+            sanatize_key(key, name);
+            if(seen.insert(key).second) keys.push_back(key);
+        }
+
+        ENSURE_LESS_EQUAL(keys.size(), max);
+        return keys;
+    }
+}
@@ -0,0 +1,250 @@
+#ifndef HENHOUSE_TAGS_H
+#define HENHOUSE_TAGS_H
+
+#include "db/catalog.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <experimental/string_view>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace stde = std::experimental;
+
+namespace henhouse::db
+{
+    using series_id = std::uint32_t;
+    using series_ids = std::vector<series_id>;
+
+    struct tag
+    {
+        std::string name;
+        std::string value;
+    };
+
+    using tag_list = std::vector<tag>;
+
+    //graphite tagged series written as name;tag=value;tag=value
+    struct tagged_series
+    {
+        std::string name;
+        tag_list tags;      //sorted by tag name
+    };
+
+    enum class tag_op { equal, not_equal, match, not_match };
+
+    //a seriesByTag expression such as dc=east, dc!=east, dc=~ea.* or dc!=~ea.*
+    struct tag_expr
+    {
+        std::string tag;
+        tag_op op;
+        std::string value;
+    };
+
+    using tag_exprs = std::vector<tag_expr>;
+
+    //true if the key has tags
+    bool is_tagged(const stde::string_view& key);
+
+    /**
+     * Parses a tagged series, sorting the tags by name so they can be searched. 
+     * Returns false if the key is not a valid tagged series, which needs a name 
+     * and non empty tags and values. The tag "name" is reserved for the name of 
+     * the series.
+     */
+    bool parse_tagged(const stde::string_view& key, tagged_series& s);
+
+    /**
+     * Parses seriesByTag('tag=value', ...) into its expressions. Returns false if
+     * s is not a seriesByTag call and throws std::invalid_argument if it is but
+     * an expression is malformed.
+     */
+    bool parse_series_by_tag(const stde::string_view& s, tag_exprs& exprs);
+
+    /**
+     * Sorted series ids compressed in blocks. The first id of a block is kept
+     * in a skip list and the rest are varint deltas, so a cursor can seek past
+     * whole blocks without decoding them. Ids must be added in increasing order.
+     */
+    class posting_list
+    {
+        public:
+            static const std::size_t BLOCK_SIZE = 128;
+
+            void add(series_id id)
+            {
+                REQUIRE(_size == 0 || id > _last);
+
+                if(_size % BLOCK_SIZE == 0) _blocks.push_back(block{id, _bytes.size()});
+                else
+                {
+                    //7 bits at a time with the high bit set on all but the last byte
+                    auto d = id - _last;
+                    while(d >= 0x80)
+                    {
+                        _bytes.push_back(static_cast<std::uint8_t>(d | 0x80));
+                        d >>= 7;
+                    }
+                    _bytes.push_back(static_cast<std::uint8_t>(d));
+                }
+
+                _last = id;
+                _size++;
+            }
+
+            std::size_t size() const { return _size; }
+
+            class cursor
+            {
+                public:
+                    explicit cursor(const posting_list& l) : _list{&l}
+                    {
+                        if(!done()) _value = l._blocks.front().first;
+                    }
+
+                    bool done() const { return _pos >= _list->_size; }
+
+                    series_id value() const
+                    {
+                        REQUIRE(!done());
+                        return _value;
+                    }
+
+                    void next()
+                    {
+                        REQUIRE(!done());
+
+                        _pos++;
+                        if(done()) return;
+
+                        if(_pos % BLOCK_SIZE == 0) jump(_pos / BLOCK_SIZE);
+                        else _value += read();
+                    }
+
+                    //moves to the first id not less than id
+                    void seek(series_id id)
+                    {
+                        if(done() || _value >= id) return;
+
+                        //last block starting at or before id
+                        const auto& blocks = _list->_blocks;
+                        const auto b = _pos / BLOCK_SIZE;
+                        const auto last = std::upper_bound(
+                                std::begin(blocks) + b + 1, std::end(blocks), id,
+                                [](series_id i, const block& x) { return i < x.first;});
+
+                        const auto to = static_cast<std::size_t>(std::distance(std::begin(blocks), last)) - 1;
+                        if(to > b)
+                        {
+                            _pos = to * BLOCK_SIZE;
+                            jump(to);
+                        }
+
+                        while(!done() && _value < id) next();
+                    }
+
+                private:
+                    void jump(std::size_t b)
+                    {
+                        REQUIRE_LESS(b, _list->_blocks.size());
+                        _value = _list->_blocks[b].first;
+                        _offset = _list->_blocks[b].offset;
+                    }
+
+                    series_id read()
+                    {
+                        series_id d = 0;
+                        for(int shift = 0;; shift += 7)
+                        {
+                            CHECK_LESS(_offset, _list->_bytes.size());
+                            const auto b = _list->_bytes[_offset++];
+                            d |= static_cast<series_id>(b & 0x7f) << shift;
+                            if(!(b & 0x80)) return d;
+                        }
+                    }
+
+                private:
+                    const posting_list* _list;
+                    std::size_t _pos = 0;
+                    std::size_t _offset = 0;
+                    series_id _value = 0;
+            };
+
+        private:
+            struct block
+            {
+                series_id first;
+                std::size_t offset;     //of the deltas after the first id
+            };
+
+            std::vector<std::uint8_t> _bytes;
+            std::vector<block> _blocks;
+            series_id _last = 0;
+            std::size_t _size = 0;
+    };
+
+    /**
+     * Ids in all the lists, stopping after max ids. The cursor of the shortest
+     * list leads and the others seek to it, so the cost follows the shortest list.
+     */
+    series_ids intersect(std::vector<const posting_list*> lists, std::size_t max);
+
+    /**
+     * Inverted index of tagged series. Each series gets an id in the order it
+     * was added and every tag=value, including name=<name>, has a posting list
+     * of the ids of series with it. Series are appended to a log in the data
+     * directory and indexed again on startup so ids stay dense.
+     *
+     * A series is the key as it was written, which is what its timeline is 
+     * stored under. The same tags written in another order are another series.
+     *
+     * This interface is thread safe.
+     */
+    class tag_index
+    {
+        public:
+            tag_index(const boost::filesystem::path& root);
+
+            /**
+             * Indexes the tagged series written as key if it is new. The key is
+             * parsed only the first time it is added. Keys that are not valid
+             * tagged series are not kept and are parsed again each time.
+             */
+            void add(const stde::string_view& key);
+            bool contains(const std::string& key) const;
+            std::size_t size() const;
+
+            /**
+             * Up to max sanatized keys of series matching all expressions, in the
+             * order they were added. Series whose keys sanatize to the same key 
+             * share a timeline so the key is returned once. Equal expressions are 
+             * intersected through the posting lists and the rest filter the result. 
+             * At least one expression must be an equal or match with a non empty 
+             * value, otherwise this throws std::invalid_argument.
+             */
+            key_list find(const tag_exprs& exprs, std::size_t max) const;
+
+        private:
+            void load();
+            void index(const std::string& key, const tagged_series& s);
+            const posting_list* postings(const std::string& tag, const std::string& value) const;
+
+        private:
+            boost::filesystem::path _log_file;
+            std::ofstream _log;
+
+            std::vector<const std::string*> _series;                    //key by id, owned by _ids
+            std::unordered_map<std::string, series_id> _ids;            //id by key
+            std::unordered_map<std::string, std::map<std::string, posting_list>> _postings;
+            mutable std::shared_mutex _mutex;
+    };
+}
+#endif
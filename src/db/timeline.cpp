@@ -1,17 +1,18 @@
 
 #include "db/timeline.hpp"
 
+#include <atomic>
 #include <exception>
+#include <random>
 #include <fstream>
 #include <functional>
+#include <unordered_set>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
 
 namespace henhouse::db
 {
-    const offset_type ADD_BUCKET_BACK_LIMIT = 60;
-
     /**
      * This is the main function to compute the partial sums given previous bucket.
      * It turns the current non-summed bucket into a summed bucket.
@@ -85,77 +86,75 @@ namespace henhouse::db
 
     bool timeline::put(time_type t, count_type c)
     {
-        //We already have data, let's add and index new point.
-        if(index.size() > 0)
-        {
-            const auto last_range = index.cend() - 1;
+        offset_type pos = 0;
+        if(!add(t, c, pos)) return false;
 
-            //don't add if time is before last range
-            if(t >= last_range->time) 
-            {
-                //get last position only because we want to keep 
-                //a specific performance profile. This is a deliberate limitation.
-                auto p = index.find_pos_from_range(t, last_range, index.cend());
-                const auto pos = p.pos + p.offset;
-
-                //bucket is current or in the past, no need to index.
-                if(pos < data.size())
-                {
-                    //if we are too far back in the range, skip it,
-                    //otherwise propogate the values up.
-                    //This limitation is to keep performance predictable for
-                    //inserts while providing a buffer for slow inserters
-                    //to catch up.
-                    if(data.size() - pos < ADD_BUCKET_BACK_LIMIT)
-                    {
-                        const auto prev = pos > 0 ? data[pos - 1] : data_item{0, 0, 0};
-                        update_current(prev, data[pos], c);
-                        for(auto p = pos + 1; p < data.size(); p++)
-                            propogate(data[p-1], data[p]);
-                    }
-                    else return false;
-                }
-                //if we move beyond end, append data 
-                else
-                {
-                    const auto last_pos = data.size() - 1;
-                    const auto prev = data[last_pos];
-
-                    //don't compute integral and second_integral
-                    //because propogate will overwrite
-                    data_item current{c, 0, 0};
-                    propogate(prev, current);
-                    data.push_back(current);
-
-                    //skip if we have no gaps, otherwise index.
-                    auto new_pos = last_pos + 1;
-                    if(pos == new_pos) return true;
-
-                    //index position
-                    const auto resolution = index.meta().resolution;
-                    CHECK_GREATER(resolution, 0);
-
-                    const auto aliased_time = p.time + (p.offset * resolution);
-                    index_item index_entry = {aliased_time, new_pos};
-
-                    CHECK_LESS_EQUAL(aliased_time, t);
-                    index.push_back(index_entry);
-                }
-            }
-            else return false;
+        added(pos);
+        return true;
+    }
+
+    bool timeline::observe(time_type t, count_type v)
+    {
+        offset_type pos = 0;
+        if(!add(t, v, pos)) return false;
+
+        added(pos);
+        if(features & HISTOGRAM_FEATURE) histogram.observe(pos, v);
+        return true;
+    }
+
+    bool timeline::add(time_type t, count_type c, offset_type& updated_pos)
+    {
+        put_pos p;
+        if(!index.find_put_pos(t, data.size(), ADD_BUCKET_BACK_LIMIT, p)) return false;
+
+        const count_type old = p.pos < data.size() ? data[p.pos].value : 0;
+
+        //bucket is current or in the past, propogate the values up.
+        if(p.pos < data.size())
+        {
+            const auto prev = p.pos > index.front().pos ? data[p.pos - 1] : base();
+            update_current(prev, data[p.pos], c);
+            for(auto i = p.pos + 1; i < data.size(); i++)
+                propogate(data[i-1], data[i]);
         }
-        //We have an empty timeline, let's add initial data point and index it.
-        else
+        //We have an empty timeline, let's add initial data point.
+        else if(data.empty())
         {
-            CHECK_EQUAL(data.size(), 0);
-
             data_item v{c, c, c * c};
             data.push_back(v);
+        }
+        //if we move beyond end, append data 
+        else
+        {
+            const auto prev = data.back();
 
-            index_item i = {t, 0};
-            index.push_back(i);
+            //don't compute integral and second_integral
+            //because propogate will overwrite
+            data_item current{c, 0, 0};
+            propogate(prev, current);
+            data.push_back(current);
         }
 
+        //index position if we have a gap or the first data point.
+        if(p.new_range) index.push_back(p.range);
+
+        if(!rollups.empty())
+        {
+            const auto s = bucket_time(t, index.front().time, index.meta().resolution);
+            const auto v = data[p.pos].value;
+            for(auto& r : rollups) r.add(s, c, (v * v) - (old * old));
+        }
+
+        updated_pos = p.pos;
+        mutations++;
+
+        //truncated in steps of a quarter of the ring so the index is rarely rewritten.
+        //Only sealed buckets are released so a ring keeps at least the late write window.
+        const auto keep = std::max(ring, ADD_BUCKET_BACK_LIMIT);
+        if(ring > 0 && data.size() - index.front().pos > keep + (keep / 4))
+            truncate_at(data.size() - keep);
+
         return true;
     }
 
@@ -183,7 +182,7 @@ namespace henhouse::db
         count_type n = (to - from) /  resolution;
 
         //if we have one bucket then first is empty data item
-        auto first_bucket = data_item{0,0,0};
+        auto first_bucket = base();
         auto last_bucket = data.back();
 
         //diff the two buckets
@@ -219,7 +218,7 @@ namespace henhouse::db
 
         // zero out data before beginning of collection
         const bool before_beginning =  t < p.time;
-        const auto dat = before_beginning ? data_item{0,0,0} : data[p.pos + p.offset];
+        const auto dat = before_beginning ? base() : data[p.pos + p.offset];
 
         return get_result 
         { 
@@ -238,7 +237,10 @@ namespace henhouse::db
         CHECK_GREATER(resolution, 0);
 
         if(a > b) std::swap(a,b);
-        if(data.size() == 0) return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, {0}, {0}};
+        if(data.size() == 0) return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, {0}, {0}, features};
+
+        diff_result rolled;
+        if(features == NO_FEATURES && diff_rollup(a, b, rolled)) return rolled;
 
         auto ar = get(a, index_offset);
         auto br = get(b, index_offset);
@@ -249,32 +251,620 @@ namespace henhouse::db
         const auto time_diff = b - a;
         auto n = time_diff / resolution;
 
-        if(n == 0) return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, ar.value, br.value};
+        if(n == 0) return diff_result{ a, b, resolution, 0, 0, 0, 0, 0, ar.value, br.value, features};
 
         CHECK_GREATER(n , 0);
         CHECK_LESS_EQUAL(ar.index_offset, br.index_offset);
-        return diff_buckets(a, b, resolution, ar.index_offset, ar.value, br.value, n);
+        auto r = diff_buckets(a, b, resolution, ar.index_offset, ar.value, br.value, n);
+        r.features = features;
+
+        if(features & EXTREMA_FEATURE) diff_extrema(ar, br, r);
+        if(features & HISTOGRAM_FEATURE) diff_histogram(ar, br, r);
+        if(features & MOMENTS_FEATURE) diff_moments(ar, br, n, r);
+        if(features & EVENTS_FEATURE) diff_events(ar, br, r);
+        if(features & TREND_FEATURE) diff_trend(ar, br, r);
+        return r;
     }
 
-    timeline from_directory(const std::string& path, const time_type resolution) 
+    /**
+     * A rollup bucket at T has the timeline buckets starting after T - resolution 
+     * up to T. A diff between a and b aligned to the rollup resolution therefore covers 
+     * the timeline buckets starting after a up to b, which is what the timeline diff 
+     * covers. The number of buckets is still counted at the timeline resolution so 
+     * mean and variance are the same. Only a timeline without features is routed since 
+     * the feature stats need the timeline buckets.
+     */
+    bool timeline::diff_rollup(time_type a, time_type b, diff_result& r) const
+    {
+        REQUIRE_LESS_EQUAL(a, b);
+
+        if(rollups.empty() || index.empty()) return false;
+        if(a < index.front().time) return false;
+
+        const auto resolution = index.meta().resolution;
+        CHECK_GREATER(resolution, 0);
+
+        for(auto it = rollups.rbegin(); it != rollups.rend(); it++)
+        {
+            const auto rollup_resolution = it->resolution();
+            if(a % rollup_resolution != 0 || b % rollup_resolution != 0) continue;
+            if(b - a < rollup_resolution) continue;
+
+            const auto ia = it->get(a);
+            const auto ib = it->get(b);
+            const count_type n = (b - a) / resolution;
+            CHECK_GREATER(n, 0);
+
+            r = diff_buckets(
+                    a, 
+                    b, 
+                    resolution, 
+                    0, 
+                    data_item{ia.value, ia.integral, ia.second_integral}, 
+                    data_item{ib.value, ib.integral, ib.second_integral}, 
+                    n);
+            r.features = features;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool timeline::rolled_up(const rollup_index& r) const
+    {
+        const auto last = r.last();
+        if(data.empty()) return last == nullptr;
+        if(last == nullptr) return false;
+
+        //a truncated timeline keeps the rollup from before the start
+        return r.front() <= r.bucket(index.front().time) && 
+            last->integral == data.back().integral && 
+            last->second_integral == data.back().second_integral;
+    }
+
+    void timeline::roll_up(rollup_index& r) const
+    {
+        r.clear();
+
+        //sums before the start of a truncated timeline go into the first bucket
+        if(!index.empty() && index.front().pos > 0)
+        {
+            const auto b = base();
+            r.add(index.front().time, b.integral, b.second_integral);
+        }
+
+        const auto resolution = index.meta().resolution;
+        for(auto i = index.cbegin(); i != index.cend(); i++)
+        {
+            const auto end = i + 1 != index.cend() ? (i + 1)->pos : data.size();
+            for(auto p = i->pos; p < end; p++)
+            {
+                const auto v = data[p].value;
+                r.add(i->time + (p - i->pos) * resolution, v, v * v);
+            }
+        }
+
+        ENSURE(rolled_up(r));
+    }
+
+    bool timeline::stored_range(
+            const get_result& ar, 
+            const get_result& br, 
+            offset_type& first, 
+            offset_type& last) const
+    {
+        const bool a_before_beginning = ar.query_time < ar.range_time;
+        const bool b_before_beginning = br.query_time < br.range_time;
+        if(b_before_beginning) return false;
+
+        first = a_before_beginning ? index.front().pos : ar.pos + ar.offset + 1;
+        last = br.pos + br.offset;
+
+        return first <= last;
+    }
+
+    /**
+     * Every range of the index is aligned to the time of the first bucket 
+     * so buckets of any time fall on one grid. Times before the first bucket
+     * wrap around, but differences of bucket times are still correct.
+     */
+    time_type bucket_time(const time_type t, const time_type front, const time_type resolution)
     {
-        REQUIRE(!path.empty());
         REQUIRE_GREATER(resolution, 0);
+        if(t >= front) return front + ((t - front) / resolution) * resolution;
+        return front - (((front - t) + resolution - 1) / resolution) * resolution;
+    }
+
+    /**
+     * The diff covers the buckets after a up to and including b. Only buckets
+     * with data are stored so there can be fewer stored buckets than buckets
+     * in the range when there are gaps or the range goes beyond the end. 
+     * Those missing buckets count as zero.
+     */
+    void timeline::diff_extrema(const get_result& ar, const get_result& br, diff_result& r) const
+    {
+        REQUIRE(features & EXTREMA_FEATURE);
+        REQUIRE(!index.empty());
+
+        const auto resolution = index.meta().resolution;
+        const auto front = index.front().time;
+        const auto buckets = 
+            (bucket_time(br.query_time, front, resolution) - 
+             bucket_time(ar.query_time, front, resolution)) / resolution;
+
+        offset_type first = 0;
+        offset_type last = 0;
+
+        r.min = 0;
+        r.max = 0;
+        if(!stored_range(ar, br, first, last)) return;
+
+        const auto stored = last - first + 1;
+        CHECK_LESS_EQUAL(stored, buckets);
+
+        const auto e = extrema.range(data, first, last);
+        r.min = e.min;
+        r.max = e.max;
+
+        if(stored < buckets)
+        {
+            r.min = std::min<count_type>(r.min, 0);
+            r.max = std::max<count_type>(r.max, 0);
+        }
+    }
+
+    void timeline::diff_histogram(const get_result& ar, const get_result& br, diff_result& r) const
+    {
+        REQUIRE(features & HISTOGRAM_FEATURE);
+
+        offset_type first = 0;
+        offset_type last = 0;
+
+        r.histogram = stored_range(ar, br, first, last) ? 
+            std::make_shared<const histogram_bins>(histogram.range(first, last)) :
+            std::make_shared<const histogram_bins>();
+    }
+
+    void timeline::diff_events(const get_result& ar, const get_result& br, diff_result& r) const
+    {
+        REQUIRE(features & EVENTS_FEATURE);
+
+        r.events = 0;
+        r.event_mean = 0;
+
+        offset_type first = 0;
+        offset_type last = 0;
+        if(!stored_range(ar, br, first, last)) return;
+
+        r.events = events.range(first, last);
+        if(r.events > 0) r.event_mean = static_cast<mean_type>(r.sum) / r.events;
+    }
+
+    time_type timeline::pos_time(offset_type pos) const
+    {
+        REQUIRE_LESS(pos, data.size());
+        REQUIRE(!index.empty());
+        REQUIRE_GREATER_EQUAL(pos, index.front().pos);
+
+        const auto range = std::upper_bound(index.cbegin(), index.cend(), pos, 
+                [](offset_type p, const auto& i) { return p < i.pos;}) - 1;
+
+        CHECK_GREATER_EQUAL(pos, range->pos);
+        return range->time + (pos - range->pos) * index.meta().resolution;
+    }
+
+    /**
+     * The least squares line through N buckets with ordinals k and values x has
+     *
+     * slope = sum((k - mean k) x) / sum((k - mean k)^2)
+     *       = 6 (2 (sum(k x) - k1 sum(x)) - (N - 1) sum(x)) / (N (N^2 - 1))
+     *
+     * where k1 is the ordinal of the first bucket and the ordinals are consecutive. 
+     * sum(k x) is the difference of two weighted prefix sums. Buckets without data 
+     * count as zero.
+     */
+    void timeline::diff_trend(const get_result& ar, const get_result& br, diff_result& r) const
+    {
+        REQUIRE(features & TREND_FEATURE);
+        REQUIRE(!index.empty());
+
+        r.slope = 0;
+        r.intercept = 0;
+
+        offset_type first = 0;
+        offset_type last = 0;
+        if(!stored_range(ar, br, first, last)) return;
+
+        const auto resolution = index.meta().resolution;
+        const auto front = index.front().time;
+        const auto b_bucket = bucket_time(br.query_time, front, resolution);
+        const count_type buckets = 
+            (b_bucket - bucket_time(ar.query_time, front, resolution)) / resolution;
+
+        CHECK_GREATER(buckets, 0);
+
+        using wide_mean = long double;
+        const wide_count_type sum = r.sum;
+        const wide_count_type k1 = static_cast<wide_count_type>(b_bucket / resolution) - buckets + 1;
+        const auto centered = 2 * (trend.range(first, last) - k1 * sum) - (buckets - 1) * sum;
+
+        const wide_mean n = static_cast<wide_mean>(buckets);
+        const wide_mean mean = static_cast<wide_mean>(sum) / n;
+        const wide_mean slope = buckets > 1 ? 6 * static_cast<wide_mean>(centered) / (n * (n * n - 1)) : 0;
+
+        r.slope = slope / resolution;
+        r.intercept = mean - slope * (n - 1) / 2;
+    }
+
+    /**
+     * Skewness and kurtosis are computed from the raw moments E[x^k] = sum(x^k) / N
+     * which give the central moments
+     *
+     * mu2 = E[x^2] - mean^2
+     * mu3 = E[x^3] - 3 mean E[x^2] + 2 mean^3
+     * mu4 = E[x^4] - 4 mean E[x^3] + 6 mean^2 E[x^2] - 3 mean^4
+     *
+     * skew = mu3 / mu2^(3/2)
+     * kurt = mu4 / mu2^2 - 3
+     *
+     * Like the mean, buckets without data count as zero.
+     */
+    void timeline::diff_moments(
+            const get_result& ar, 
+            const get_result& br, 
+            const count_type n, 
+            diff_result& r) const
+    {
+        REQUIRE(features & MOMENTS_FEATURE);
+        REQUIRE_GREATER(n, 0);
+
+        r.skew = 0;
+        r.kurt = 0;
+
+        offset_type first = 0;
+        offset_type last = 0;
+        if(!stored_range(ar, br, first, last)) return;
 
-        fs::create_directory(path);
-        if(!fs::is_directory(path))
-            throw std::runtime_error{"path " + path + " is not a directory"}; 
+        using wide_mean = long double;
+        const auto m = moments.range(first, last);
+
+        const wide_mean e1 = static_cast<wide_mean>(r.sum) / n;
+        const wide_mean e2 = static_cast<wide_mean>(br.value.second_integral - ar.value.second_integral) / n;
+        const wide_mean e3 = static_cast<wide_mean>(m.third_integral) / n;
+        const wide_mean e4 = static_cast<wide_mean>(m.fourth_integral) / n;
+
+        const auto e1_2 = e1 * e1;
+        const auto mu2 = e2 - e1_2;
+        if(mu2 <= 0) return;
+
+        const auto mu3 = e3 - 3 * e1 * e2 + 2 * e1_2 * e1;
+        const auto mu4 = e4 - 4 * e1 * e3 + 6 * e1_2 * e2 - 3 * e1_2 * e1_2;
+
+        r.skew = mu3 / (mu2 * std::sqrt(mu2));
+        r.kurt = mu4 / (mu2 * mu2) - 3;
+    }
+
+    /**
+     * Puts can only change the last ADD_BUCKET_BACK_LIMIT buckets or append new ones.
+     * Any bucket before that, or before the beginning of the timeline, is sealed
+     * and so is any diff ending in it.
+     */
+    bool timeline::sealed(time_type t) const
+    {
+        if(data.size() < ADD_BUCKET_BACK_LIMIT) return false;
+
+        auto p = index.find_pos(t, 0);
+        if(t < p.time) return true;
+
+        const auto pos = p.pos + p.offset;
+        if(pos >= data.size()) return false;
+
+        return data.size() - pos >= ADD_BUCKET_BACK_LIMIT;
+    }
+
+    /**
+     * A sealed range never changes so its version is constant until the timeline
+     * is truncated, which moves the start, or is opened with other features or 
+     * rollups, which change what a diff returns. Otherwise the version changes with every 
+     * put. The epoch is new every time a timeline is opened so versions of a reopened 
+     * timeline never match old ones. Sealed versions are even and the others odd.
+     */
+    version_type timeline::version(time_type t) const
+    {
+        //a sealed diff also depends on which features and rollups answer it
+        if(sealed(t)) 
+        {
+            version_type v = index.front().pos;
+            v ^= features + 0x9e3779b9 + (v << 6) + (v >> 2);
+            for(const auto& r : rollups)
+                v ^= r.resolution() + 0x9e3779b9 + (v << 6) + (v >> 2);
+            return SEALED_VERSION + (v << 1);
+        }
+
+        auto v = epoch;
+        v ^= mutations + 0x9e3779b9 + (v << 6) + (v >> 2);
+        v ^= data.size() + 0x9e3779b9 + (v << 6) + (v >> 2);
+        return v | 1;
+    }
+
+    offset_type timeline::sealed_size() const
+    {
+        return data.size() < ADD_BUCKET_BACK_LIMIT ? 0 : data.size() - ADD_BUCKET_BACK_LIMIT + 1;
+    }
+
+    data_item timeline::base() const
+    {
+        if(index.empty() || index.front().pos == 0) return data_item{0, 0, 0};
+
+        const auto& f = data[index.front().pos];
+        return data_item{0, f.integral - f.value, f.second_integral - (f.value * f.value)};
+    }
+
+    bool timeline::truncate(time_type t)
+    {
+        if(index.empty()) return false;
+
+        auto p = index.find_pos(t, 0);
+        if(t < p.time) return false;
+        clamp(p, data.size());
+
+        return truncate_at(p.pos + p.offset);
+    }
+
+    /**
+     * Only sealed buckets are released so puts never change a bucket before the start. 
+     * The index is rewritten to begin at the new first bucket and the pages of data 
+     * before it are released. Positions don't change so the data and the feature 
+     * structures stay aligned, and the prefix sums of the first bucket give the sums 
+     * before it.
+     */
+    bool timeline::truncate_at(offset_type start)
+    {
+        if(index.empty()) return false;
+
+        const auto sealed = sealed_size();
+        if(sealed == 0) return false;
+
+        start = std::min<offset_type>(start, sealed - 1);
+        if(start <= index.front().pos) return false;
+
+        const auto range = std::upper_bound(index.cbegin(), index.cend(), start, 
+                [](offset_type s, const auto& i) { return s < i.pos;}) - 1;
+
+        const offset_type first = range - index.cbegin();
+        const index_item front{range->time + (start - range->pos) * index.meta().resolution, start};
+
+        index[0] = front;
+        for(auto i = first + 1; i < index.size(); i++)
+            index[i - first] = index[i];
+        index.meta().size -= first;
+
+        data.release_front(start);
+
+        //queries never reach blocks or rollup buckets before the start
+        if(features & EXTREMA_FEATURE) extrema.release_front(start);
+        for(auto& r : rollups) r.release_before(front.time);
+
+        //ranges of the features need the prefix sums before the start
+        if(features & HISTOGRAM_FEATURE) histogram.release_front(start - 1);
+        if(features & MOMENTS_FEATURE) moments.release_front(start - 1);
+        if(features & EVENTS_FEATURE) events.release_front(start - 1);
+        if(features & TREND_FEATURE) trend.release_front(start - 1);
+
+        mutations++;
+
+        ENSURE_EQUAL(index.front().pos, start);
+        return true;
+    }
+
+    void timeline::unmap()
+    {
+        index.unmap();
+        data.unmap();
+
+        if(features & EXTREMA_FEATURE) extrema.unmap();
+        if(features & HISTOGRAM_FEATURE) histogram.unmap();
+        if(features & MOMENTS_FEATURE) moments.unmap();
+        if(features & EVENTS_FEATURE) events.unmap();
+        if(features & TREND_FEATURE) trend.unmap();
+
+        for(auto& r : rollups) r.unmap();
+    }
+
+    void timeline::map()
+    {
+        index.map();
+        data.map();
+
+        if(features & EXTREMA_FEATURE) extrema.map();
+        if(features & HISTOGRAM_FEATURE) histogram.map();
+        if(features & MOMENTS_FEATURE) moments.map();
+        if(features & EVENTS_FEATURE) events.map();
+        if(features & TREND_FEATURE) trend.map();
+
+        for(auto& r : rollups) r.map();
+    }
+
+    void timeline::update_features(offset_type pos)
+    {
+        if(features & EXTREMA_FEATURE) extrema.seal(data, sealed_size());
+        if(features & HISTOGRAM_FEATURE) histogram.grow(data.size());
+        if(features & MOMENTS_FEATURE) moments.update(data, pos);
+        if(features & EVENTS_FEATURE) events.grow(data.size());
+        if(features & TREND_FEATURE) 
+        {
+            const auto resolution = index.meta().resolution;
+            //buckets before the start read as zero so any ordinal will do
+            const auto start = index.empty() ? 0 : index.front().pos;
+            trend.update(data, pos, [&](offset_type p) { return pos_time(std::max(p, start)) / resolution;});
+        }
+    }
+
+    void timeline::added(offset_type pos)
+    {
+        update_features(pos);
+        if(features & EVENTS_FEATURE) events.record(pos);
+    }
+
+    using file_names = std::unordered_set<std::string>;
+
+    /**
+     * Names of the files in dir. Creates dir and its parents if it doesn't exist, 
+     * since the catalog can list a key whose directory was removed.
+     */
+    file_names list_files(const fs::path& dir)
+    {
+        REQUIRE(!dir.empty());
+
+        file_names files;
+
+        boost::system::error_code e;
+        fs::directory_iterator it{dir, e}, end;
+        if(e)
+        {
+            fs::create_directories(dir);
+            if(!fs::is_directory(dir))
+                throw std::runtime_error{"path " + dir.string() + " is not a directory"}; 
+            return files;
+        }
+
+        for(; it != end; it++) files.insert(it->path().filename().string());
+        return files;
+    }
+
+    version_type new_epoch()
+    {
+        static std::atomic<version_type> epoch{std::random_device{}()};
+        return epoch.fetch_add(1);
+    }
+
+    /**
+     * A read only open never creates or writes a file. Only the structures stored 
+     * in the directory are opened, and the ones behind the data are left out
+     * instead of being brought up to date.
+     */
+    timeline open_directory(
+            const std::string& path, 
+            const time_type resolution, 
+            const feature_set features,
+            const rollup_resolutions& rollups,
+            const offset_type ring,
+            const bool read_only) 
+    {
+        REQUIRE(!path.empty());
+        REQUIRE_GREATER(resolution, 0);
 
         fs::path root = path;
 
+        //one listing tells which structures exist instead of a stat for each
+        file_names files;
+        if(read_only)
+        {
+            boost::system::error_code e;
+            for(fs::directory_iterator it{root, e}, end; !e && it != end; it++) 
+                files.insert(it->path().filename().string());
+            if(!files.count("_.i") || !files.count("_.d"))
+                throw std::runtime_error{"no timeline in " + root.string()};
+        }
+        else files = list_files(root);
+
         timeline t;
 
         fs::path idx_data = root / "_.i";
         t.index = std::move(index_type{idx_data, resolution});
 
         fs::path cdata = root / "_.d";
-        t.data = std::move(data_type{cdata, DATA_SIZE});
+        auto segment_items = std::max<time_type>(DATA_SEGMENT_SPAN / t.index.meta().resolution, 1);
+        if(ring > 0) segment_items = std::min<time_type>(segment_items, std::max<offset_type>(ring / 4, 1));
+        t.data = std::move(data_type{cdata, DATA_SIZE, segment_items});
+
+        //a feature stays on once its file exists. Missing structures are
+        //built from the existing data.
+        fs::path extrema_data = root / "_.x";
+        if((features & EXTREMA_FEATURE) || files.count(extrema_data.filename().string()))
+        {
+            t.extrema = std::move(extrema_index{extrema_data});
+            t.features |= EXTREMA_FEATURE;
+        }
+
+        fs::path histogram_data = root / "_.h";
+        if((features & HISTOGRAM_FEATURE) || files.count(histogram_data.filename().string()))
+        {
+            t.histogram = std::move(histogram_index{histogram_data});
+            t.features |= HISTOGRAM_FEATURE;
+        }
+
+        fs::path moments_data = root / "_.m";
+        if((features & MOMENTS_FEATURE) || files.count(moments_data.filename().string()))
+        {
+            t.moments = std::move(moments_index{moments_data});
+            t.features |= MOMENTS_FEATURE;
+        }
+
+        //puts before the feature was enabled are not known and count as none 
+        fs::path events_data = root / "_.e";
+        if((features & EVENTS_FEATURE) || files.count(events_data.filename().string()))
+        {
+            t.events = std::move(events_index{events_data});
+            t.features |= EVENTS_FEATURE;
+        }
+
+        fs::path trend_data = root / "_.t";
+        if((features & TREND_FEATURE) || files.count(trend_data.filename().string()))
+        {
+            t.trend = std::move(trend_index{trend_data});
+            t.features |= TREND_FEATURE;
+        }
+
+        if(read_only) 
+        {
+            const auto size = t.data.size();
+            if((t.features & HISTOGRAM_FEATURE) && t.histogram.size() < size) t.features &= ~HISTOGRAM_FEATURE;
+            if((t.features & MOMENTS_FEATURE) && t.moments.size() < size) t.features &= ~MOMENTS_FEATURE;
+            if((t.features & EVENTS_FEATURE) && t.events.size() < size) t.features &= ~EVENTS_FEATURE;
+            if((t.features & TREND_FEATURE) && t.trend.size() < size) t.features &= ~TREND_FEATURE;
+        }
+        //only fills in what is missing from each structure
+        else t.update_features(t.data.size());
+
+        //rollups no coarser than the timeline are useless
+        const auto tl_resolution = t.index.meta().resolution;
+        for(const auto r : rollups)
+        {
+            if(r <= tl_resolution) continue;
+
+            const auto name = "_.r" + std::to_string(r);
+            if(read_only && !files.count(name)) continue;
+
+            t.rollups.emplace_back(root / name, r);
+            if(t.rolled_up(t.rollups.back())) continue;
+
+            if(read_only) t.rollups.pop_back();
+            else t.roll_up(t.rollups.back());
+        }
+
+        t.ring = ring;
+        t.epoch = new_epoch();
 
         return t;
     }
+
+    timeline from_directory(
+            const std::string& path, 
+            const time_type resolution, 
+            const feature_set features,
+            const rollup_resolutions& rollups,
+            const offset_type ring) 
+    {
+        return open_directory(path, resolution, features, rollups, ring, false);
+    }
+
+    timeline read_directory(
+            const std::string& path, 
+            const time_type resolution, 
+            const rollup_resolutions& rollups,
+            const offset_type ring) 
+    {
+        return open_directory(path, resolution, NO_FEATURES, rollups, ring, true);
+    }
 }
@@ -1,8 +1,16 @@
 #ifndef HENHOUSE_TIMELINE_H
 #define HENHOUSE_TIMELINE_H
 
+#include "db/types.hpp"
+#include "db/extrema.hpp"
+#include "db/histogram.hpp"
+#include "db/moments.hpp"
+#include "db/events.hpp"
+#include "db/trend.hpp"
+#include "db/rollup.hpp"
 #include "util/dbc.hpp"
 #include "util/mapped_vector.hpp"
+#include "util/segmented_vector.hpp"
 
 #include <string>
 #include <algorithm>
@@ -10,14 +18,6 @@
 
 namespace henhouse::db
 {
-    using time_type = std::uint64_t;
-    using count_type = std::int64_t;
-    using offset_type = std::uint64_t;
-
-    //TODO, use rational numbers instead in the future.
-    using mean_type = double;
-    using variance_type = double;
-
     struct index_item
     {
         time_type time = 0;
@@ -42,7 +42,15 @@ namespace henhouse::db
         count_type second_integral;
     };
 
+    const version_type SEALED_VERSION = 0;
+
+    //puts can only change this many buckets back from the end
+    const offset_type ADD_BUCKET_BACK_LIMIT = 60;
+
     const std::size_t DATA_SIZE = util::PAGE_SIZE;
+
+    //time covered by each segment file of the data
+    const time_type DATA_SEGMENT_SPAN = 7 * 24 * 60 * 60;
     const std::size_t INDEX_SIZE = util::PAGE_SIZE;
 
     struct pos_result
@@ -53,6 +61,14 @@ namespace henhouse::db
         offset_type offset;
     };
 
+    //where a put goes and the new range to index once the data is appended.
+    struct put_pos
+    {
+        offset_type pos = 0;
+        bool new_range = false;
+        index_item range;
+    };
+
     class index_type : public util::mapped_vector<index_metadata, index_item>
     {
         public:
@@ -107,13 +123,69 @@ namespace henhouse::db
             {
                 if(empty()) return pos_result {0, t, 0, 0};
                 const auto range = find_range(t, offset);
-                if(range == nullptr) return pos_result{0, front().time, 0, 0};
+                if(range == nullptr) return pos_result{0, front().time, front().pos, 0};
 
                 return find_pos_from_range(t, range, range + 1);
             }
+
+            /**
+             * Finds the position of the bucket a put at time t goes into given size 
+             * buckets of data. A position of size means a new bucket is appended.
+             * Returns false if the put is before the last range or more than back_limit 
+             * buckets behind the end.
+             */
+            bool find_put_pos(
+                    time_type t, 
+                    const offset_type size, 
+                    const offset_type back_limit, 
+                    put_pos& r) const
+            {
+                INVARIANT(_metadata);
+
+                //We have an empty timeline, index the initial data point.
+                if(empty())
+                {
+                    REQUIRE_EQUAL(size, 0);
+                    r = put_pos{0, true, index_item{t, 0}};
+                    return true;
+                }
+
+                const auto last_range = cend() - 1;
+
+                //don't add if time is before last range
+                if(t < last_range->time) return false;
+
+                //get last position only because we want to keep 
+                //a specific performance profile. This is a deliberate limitation.
+                auto p = find_pos_from_range(t, last_range, cend());
+                const auto pos = p.pos + p.offset;
+
+                //bucket is current or in the past, no need to index.
+                //if we are too far back in the range, skip it.
+                //This limitation is to keep performance predictable for
+                //inserts while providing a buffer for slow inserters
+                //to catch up.
+                if(pos < size)
+                {
+                    if(size - pos >= back_limit) return false;
+
+                    r = put_pos{pos, false, index_item{}};
+                    return true;
+                }
+
+                //if we move beyond end, append and index position if we have a gap.
+                const auto resolution = _metadata->resolution;
+                CHECK_GREATER(resolution, 0);
+
+                const auto aliased_time = p.time + (p.offset * resolution);
+                CHECK_LESS_EQUAL(aliased_time, t);
+
+                r = put_pos{size, pos != size, index_item{aliased_time, size}};
+                return true;
+            }
     };
 
-    using data_type = util::mapped_vector<data_metadata, data_item>;
+    using data_type = util::segmented_vector<data_metadata, data_item>;
 
     struct summary_result
     {
@@ -148,6 +220,16 @@ namespace henhouse::db
         count_type size;
         data_item left;             //left bucket
         data_item right;            //right bucket. 
+        feature_set features = NO_FEATURES; //features the stats below were computed with
+        count_type min = 0;         //smallest bucket value within time range. Needs EXTREMA_FEATURE
+        count_type max = 0;         //largest bucket value within time range. Needs EXTREMA_FEATURE
+        histogram_ptr histogram;    //observations per bin within time range. Needs HISTOGRAM_FEATURE
+        mean_type skew = 0;         //skewness of values within time range. Needs MOMENTS_FEATURE
+        mean_type kurt = 0;         //excess kurtosis of values within time range. Needs MOMENTS_FEATURE
+        count_type events = 0;      //puts within time range. Needs EVENTS_FEATURE
+        mean_type event_mean = 0;   //mean of values added per put within time range. Needs EVENTS_FEATURE
+        mean_type slope = 0;        //least squares slope per second within time range. Needs TREND_FEATURE
+        mean_type intercept = 0;    //least squares fit at the first bucket of time range. Needs TREND_FEATURE
     };
 
     /**
@@ -161,14 +243,138 @@ namespace henhouse::db
         index_type index;
         data_type data;
 
+        //optional structures maintained along with the data
+        feature_set features = NO_FEATURES;
+        extrema_index extrema;
+        histogram_index histogram;
+        moments_index moments;
+        events_index events;
+        trend_index trend;
+
+        //coarser timelines maintained along with the data, from finest to coarsest
+        rollup_indexes rollups;
+
+        //buckets kept by a ring timeline, which truncates itself as data is appended. 0 keeps all.
+        offset_type ring = 0;
+
+        //not persisted, used to version the timeline while it is open.
+        version_type epoch = 0;
+        version_type mutations = 0;
+
+        //not persisted, set by the db when the timeline is used to find cold timelines.
+        std::uint64_t accessed = 0;
+
         bool put(time_type t, count_type c);
 
+        //adds v to the bucket at time t and counts it as an observation in the histogram.
+        bool observe(time_type t, count_type v);
+
         summary_result summary() const;  
 
         get_result get(time_type t, const offset_type index_offset) const;
         diff_result diff(time_type a, time_type b, const offset_type index_offset) const;
+
+        //true if the bucket at time t can no longer change. 
+        bool sealed(time_type t) const;
+
+        //version of the timeline up to time t. Changes when the range changes.
+        version_type version(time_type t) const;
+
+        //number of buckets from the start that can no longer change.
+        offset_type sealed_size() const;
+
+        //sums before the first bucket, which are not zero once the timeline is truncated.
+        data_item base() const;
+
+        //moves the start of the timeline forward to the bucket containing t. False if it did not move.
+        bool truncate(time_type t);
+
+        //moves the start of the timeline forward to position start. False if it did not move.
+        bool truncate_at(offset_type start);
+
+        /**
+         * Unmaps the files of all structures so they no longer count as mapped. 
+         * The timeline can't be used until map maps them again.
+         */
+        void unmap();
+        void map();
+        bool mapped() const { return index.mapped(); }
+
+        //adds c to the bucket at time t and sets pos to its position
+        bool add(time_type t, count_type c, offset_type& pos);
+
+        //positions of the stored buckets in the diff. False if there are none.
+        bool stored_range(
+                const get_result& a, 
+                const get_result& b, 
+                offset_type& first, 
+                offset_type& last) const;
+
+        //computes min and max of the buckets in the diff
+        void diff_extrema(const get_result& a, const get_result& b, diff_result& r) const;
+
+        //computes the histogram of observations in the diff
+        void diff_histogram(const get_result& a, const get_result& b, diff_result& r) const;
+
+        //computes the puts and mean value per put in the diff
+        void diff_events(const get_result& a, const get_result& b, diff_result& r) const;
+
+        //computes the least squares line through the buckets in the diff
+        void diff_trend(const get_result& a, const get_result& b, diff_result& r) const;
+
+        //time of the bucket at position pos
+        time_type pos_time(offset_type pos) const;
+
+        //computes skewness and kurtosis of the n buckets in the diff
+        void diff_moments(const get_result& a, const get_result& b, count_type n, diff_result& r) const;
+
+        //diff from the coarsest rollup aligned with a and b. False if there is none.
+        bool diff_rollup(time_type a, time_type b, diff_result& r) const;
+
+        //true if the rollup has all the data
+        bool rolled_up(const rollup_index& r) const;
+
+        //rebuilds the rollup from the data
+        void roll_up(rollup_index& r) const;
+
+        //brings the feature structures up to date with the data changed from position pos.
+        void update_features(offset_type pos);
+
+        //updates the feature structures after a put into the bucket at pos
+        void added(offset_type pos);
     };
 
-    timeline from_directory(const std::string& path, const time_type resolution);
+    //clamps the position to be within the data
+    void clamp(pos_result& r, std::size_t size);
+
+    //time of the bucket containing t. Buckets of a timeline are aligned to the first one.
+    time_type bucket_time(const time_type t, const time_type front, const time_type resolution);
+
+    /**
+     * Opens the timeline in the directory. Features requested are created if
+     * missing. Features already stored in the directory are always maintained.
+     * Rollups coarser than the timeline resolution are maintained and rebuilt
+     * if they are missing data. Rollup resolutions must be in ascending order.
+     * A ring timeline keeps the last ring buckets and uses smaller data segments
+     * so released space is bounded by the ring.
+     */
+    timeline from_directory(
+            const std::string& path, 
+            const time_type resolution, 
+            const feature_set features = NO_FEATURES,
+            const rollup_resolutions& rollups = rollup_resolutions{},
+            const offset_type ring = 0);
+
+    /**
+     * Opens an existing timeline for reading without creating or writing any file,
+     * for scans over timelines that are not cached. Feature structures and rollups 
+     * stored in the directory are used if they are up to date with the data. 
+     * Missing ones are not built, so their stats read as zero.
+     */
+    timeline read_directory(
+            const std::string& path, 
+            const time_type resolution, 
+            const rollup_resolutions& rollups = rollup_resolutions{},
+            const offset_type ring = 0);
 }
 #endif
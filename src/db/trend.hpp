@@ -0,0 +1,82 @@
+#ifndef HENHOUSE_TREND_H
+#define HENHOUSE_TREND_H
+
+#include "db/types.hpp"
+#include "util/dbc.hpp"
+#include "util/mapped_vector.hpp"
+
+#include <algorithm>
+
+namespace henhouse::db
+{
+    //sum of ordinal * value up to and including a bucket
+    struct trend_item
+    {
+        wide_count_type weighted_integral;
+    };
+
+    struct trend_metadata
+    {
+        std::size_t size = 0;
+    };
+
+    using trend_data = util::mapped_vector<trend_metadata, trend_item>;
+
+    const std::size_t TREND_SIZE = util::PAGE_SIZE;
+
+    /**
+     * Prefix sums of bucket values weighted by the ordinal of the bucket,
+     * which is its time divided by the resolution. Kept aligned with the
+     * positions of the timeline data.
+     *
+     * This interface is NOT thread safe.
+     */
+    class trend_index
+    {
+        public:
+            trend_index() {}
+            trend_index(const boost::filesystem::path& file) : _data{file, TREND_SIZE} {}
+
+            //recomputes the prefix sums from position pos to the end of the data
+            template <class items, class ordinal_func>
+                void update(const items& data, offset_type pos, ordinal_func ordinal)
+                {
+                    pos = std::min<offset_type>(pos, _data.size());
+
+                    for(auto p = pos; p < data.size(); p++)
+                    {
+                        const wide_count_type v = data[p].value;
+                        const wide_count_type i = ordinal(p);
+                        const auto prev = p > 0 ? _data[p - 1].weighted_integral : 0;
+
+                        const trend_item t{prev + i * v};
+                        if(p < _data.size()) _data[p] = t;
+                        else _data.push_back(t);
+                    }
+
+                    ENSURE_EQUAL(_data.size(), data.size());
+                }
+
+            //sum of ordinal * value between positions l and r inclusive.
+            wide_count_type range(offset_type l, offset_type r) const
+            {
+                REQUIRE_LESS_EQUAL(l, r);
+                REQUIRE_LESS(r, _data.size());
+
+                const auto prev = l > 0 ? _data[l - 1].weighted_integral : 0;
+                return _data[r].weighted_integral - prev;
+            }
+
+            std::size_t size() const { return _data.size(); }
+
+            //releases the disk space of the items before pos
+            void release_front(offset_type pos) { _data.release_front(std::min<offset_type>(pos, _data.size())); }
+
+            void unmap() { _data.unmap(); }
+            void map() { _data.map(); }
+
+        private:
+            trend_data _data;
+    };
+}
+#endif
@@ -0,0 +1,32 @@
+#ifndef HENHOUSE_TYPES_H
+#define HENHOUSE_TYPES_H
+
+#include <cstdint>
+
+namespace henhouse::db
+{
+    using time_type = std::uint64_t;
+    using count_type = std::int64_t;
+    using offset_type = std::uint64_t;
+    using version_type = std::uint64_t;
+
+    //used for sums of higher powers which overflow 64 bits
+    using wide_count_type = __int128;
+
+    //TODO, use rational numbers instead in the future.
+    using mean_type = double;
+    using variance_type = double;
+
+    /**
+     * Optional structures a timeline can maintain alongside its data. 
+     * Each feature is stored in its own file next to the timeline data.
+     */
+    using feature_set = std::uint32_t;
+    const feature_set NO_FEATURES = 0;
+    const feature_set EXTREMA_FEATURE = 1 << 0;
+    const feature_set HISTOGRAM_FEATURE = 1 << 1;
+    const feature_set MOMENTS_FEATURE = 1 << 2;
+    const feature_set EVENTS_FEATURE = 1 << 3;
+    const feature_set TREND_FEATURE = 1 << 4;
+}
+#endif
@@ -6,8 +6,11 @@
 #include <sstream>
 #include <vector>
 #include <limits>
+#include <algorithm>
 
 #include <boost/program_options.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
 
 using folly::EventBase;
 using folly::EventBaseManager;
@@ -33,13 +36,47 @@ po::options_description create_descriptions()
         ("query_workers", po::value<std::size_t>()->default_value(workers), "Query threads")
         ("db_workers", po::value<std::size_t>()->default_value(workers), "DB workers")
         ("queue_size", po::value<std::size_t>()->default_value(10000), "Input queue size")
-        ("cache_size", po::value<std::size_t>()->default_value(40), 
-          "Size of timeline db reference cache per worker. "
-          "make this too big an you can run out of file descriptors.")
+        ("cache_size", po::value<std::size_t>()->default_value(4000), 
+          "Size of timeline db reference cache per worker. Cached timelines "
+          "don't hold file descriptors but each maps two or more files, "
+          "so the total across workers should stay below vm.max_map_count.")
+        ("result_cache_size", po::value<std::size_t>()->default_value(50000), 
+         "Number of diff results of sealed time ranges cached per worker. 0 disables the cache.")
         ("resolution", po::value<henhouse::db::time_type>()->default_value(60), 
          "Minimum resolution in seconds of a timeline.")
-        ("max_response_values", po::value<std::size_t>()->default_value(10000), 
-         "Maximum points returned in a values response.");
+        ("values_window", po::value<std::size_t>()->default_value(1000), 
+         "Values computed per chunk of a streamed values response.")
+        ("extrema", po::value<std::vector<std::string>>()->multitoken(), 
+         "Key globs of timelines that maintain range min and max.")
+        ("histograms", po::value<std::vector<std::string>>()->multitoken(), 
+         "Key globs of timelines that keep histograms of observations for quantiles.")
+        ("moments", po::value<std::vector<std::string>>()->multitoken(), 
+         "Key globs of timelines that maintain skewness and kurtosis.")
+        ("events", po::value<std::vector<std::string>>()->multitoken(), 
+         "Key globs of timelines that count puts per bucket.")
+        ("trend", po::value<std::vector<std::string>>()->multitoken(), 
+         "Key globs of timelines that maintain the least squares trend.")
+        ("pairs", po::value<std::vector<std::string>>()->multitoken(), 
+         "Pairs of keys, written as x,y, to maintain correlation of.")
+        ("rollups", po::value<std::vector<henhouse::db::time_type>>()->multitoken(), 
+         "Resolutions in seconds of coarser timelines maintained for every key to speed up long queries.")
+        ("retention", po::value<std::vector<std::string>>()->multitoken(), 
+         "Key globs and the seconds of data to keep, written as glob,seconds. The first matching glob is used.")
+        ("retention_interval", po::value<std::time_t>()->default_value(3600), 
+         "Seconds between truncating timelines with a retention.")
+        ("ring", po::value<std::vector<std::string>>()->multitoken(), 
+         "Key globs of ring timelines and the seconds of data they keep, written as glob,seconds "
+         "or glob,seconds,resolution to create them at a different resolution.")
+        ("hot_keys", po::value<std::size_t>()->default_value(1000), 
+         "Number of heavy hitter keys tracked per worker.")
+        ("hot_window", po::value<std::time_t>()->default_value(300), 
+         "Seconds of recent puts the heavy hitters are tracked over.")
+        ("mapped_budget", po::value<std::size_t>()->default_value(0), 
+         "Megabytes of files mapped by all workers before the least recently used "
+         "timelines are unmapped. Counts mapped file sizes, not resident memory. 0 is unlimited.")
+        ("openers", po::value<std::size_t>()->default_value(2), 
+         "Threads opening timelines that are not cached so workers don't wait on disk. "
+         "0 opens them on the worker.");
 
     return d;
 }
@@ -53,6 +90,112 @@ po::variables_map parse_options(int argc, char* argv[], po::options_description&
     return v;
 }
 
+void add_feature_rules(
+        henhouse::db::feature_rules& rules, 
+        const po::variables_map& opt, 
+        const std::string& name, 
+        const henhouse::db::feature_set feature)
+{
+    if(!opt.count(name)) return;
+
+    for(const auto& g : opt[name].as<std::vector<std::string>>())
+    {
+        henhouse::db::feature_rule r{"", feature};
+        henhouse::db::sanatize_glob(r.glob, g);
+        rules.push_back(r);
+    }
+}
+
+henhouse::db::key_pairs parse_pairs(const po::variables_map& opt)
+{
+    henhouse::db::key_pairs pairs;
+    if(!opt.count("pairs")) return pairs;
+
+    for(const auto& p : opt["pairs"].as<std::vector<std::string>>())
+    {
+        const auto comma = p.find(',');
+        if(comma == std::string::npos || comma == 0 || comma + 1 == p.size() || p.find(',', comma + 1) != std::string::npos)
+            throw std::invalid_argument{"pair " + p + " must be two keys written as x,y"};
+
+        henhouse::db::key_pair k;
+        henhouse::db::sanatize_key(k.x, stde::string_view{p.data(), comma});
+        henhouse::db::sanatize_key(k.y, stde::string_view{p.data() + comma + 1, p.size() - comma - 1});
+        pairs.push_back(k);
+    }
+
+    return pairs;
+}
+
+henhouse::db::retention_rules parse_retention(const po::variables_map& opt)
+{
+    henhouse::db::retention_rules rules;
+    if(!opt.count("retention")) return rules;
+
+    for(const auto& r : opt["retention"].as<std::vector<std::string>>())
+    {
+        const auto comma = r.rfind(',');
+        if(comma == std::string::npos || comma == 0 || comma + 1 == r.size())
+            throw std::invalid_argument{"retention " + r + " must be a glob and seconds written as glob,seconds"};
+
+        henhouse::db::retention_rule rule{"", 0};
+        henhouse::db::sanatize_glob(rule.glob, stde::string_view{r.data(), comma});
+        rule.seconds = boost::lexical_cast<henhouse::db::time_type>(r.substr(comma + 1));
+        if(rule.seconds == 0) throw std::invalid_argument{"retention of " + r + " must be greater than 0"};
+
+        rules.push_back(rule);
+    }
+
+    return rules;
+}
+
+henhouse::db::ring_rules parse_rings(const po::variables_map& opt, const henhouse::db::time_type default_resolution)
+{
+    henhouse::db::ring_rules rules;
+    if(!opt.count("ring")) return rules;
+
+    for(const auto& r : opt["ring"].as<std::vector<std::string>>())
+    {
+        std::vector<std::string> parts;
+        boost::split(parts, r, boost::is_any_of(","));
+        if(parts.size() < 2 || parts.size() > 3 || parts[0].empty())
+            throw std::invalid_argument{"ring " + r + " must be written as glob,seconds or glob,seconds,resolution"};
+
+        henhouse::db::ring_rule rule{"", 0, 0};
+        henhouse::db::sanatize_glob(rule.glob, parts[0]);
+        rule.seconds = boost::lexical_cast<henhouse::db::time_type>(parts[1]);
+        if(parts.size() == 3) rule.resolution = boost::lexical_cast<henhouse::db::time_type>(parts[2]);
+
+        if(rule.seconds == 0) throw std::invalid_argument{"ring " + r + " must keep more than 0 seconds"};
+        if(parts.size() == 3 && rule.resolution == 0) 
+            throw std::invalid_argument{"ring " + r + " must have a resolution greater than 0"};
+
+        //buckets within the late write window can't be released, so a shorter ring would never shrink
+        const auto resolution = rule.resolution > 0 ? rule.resolution : default_resolution;
+        if(rule.seconds / resolution < henhouse::db::ADD_BUCKET_BACK_LIMIT)
+            throw std::invalid_argument{
+                "ring " + r + " must keep at least " + 
+                    std::to_string(henhouse::db::ADD_BUCKET_BACK_LIMIT) + " buckets"};
+
+        rules.push_back(rule);
+    }
+
+    return rules;
+}
+
+henhouse::db::rollup_resolutions parse_rollups(const po::variables_map& opt)
+{
+    henhouse::db::rollup_resolutions rollups;
+    if(!opt.count("rollups")) return rollups;
+
+    rollups = opt["rollups"].as<henhouse::db::rollup_resolutions>();
+    for(const auto r : rollups)
+        if(r == 0) throw std::invalid_argument{"rollup resolutions must be greater than 0"};
+
+    std::sort(std::begin(rollups), std::end(rollups));
+    rollups.erase(std::unique(std::begin(rollups), std::end(rollups)), std::end(rollups));
+    return rollups;
+}
+
 int main(int argc, char** argv)
 try
 {
@@ -74,17 +217,69 @@ try
     const auto data_dir = opt["data"].as<std::string>();
     const auto queue_size = opt["queue_size"].as<std::size_t>();
     const auto cache_size = opt["cache_size"].as<std::size_t>();
+    const auto result_cache_size = opt["result_cache_size"].as<std::size_t>();
     const auto new_timeline_resolution = opt["resolution"].as<henhouse::db::time_type>();
-    const auto max_values = opt["max_response_values"].as<std::size_t>();
+    const auto values_window = opt["values_window"].as<std::size_t>();
+    const auto hot_keys = opt["hot_keys"].as<std::size_t>();
+    const auto hot_window = opt["hot_window"].as<std::time_t>();
+    const auto mapped_budget = opt["mapped_budget"].as<std::size_t>();
+    const auto openers = opt["openers"].as<std::size_t>();
+
+    if(hot_keys == 0) throw std::invalid_argument{"hot_keys must be greater than 0"};
+    if(hot_window <= 0) throw std::invalid_argument{"hot_window must be greater than 0"};
+
+    henhouse::db::feature_rules features;
+    add_feature_rules(features, opt, "extrema", henhouse::db::EXTREMA_FEATURE);
+    add_feature_rules(features, opt, "histograms", henhouse::db::HISTOGRAM_FEATURE);
+    add_feature_rules(features, opt, "moments", henhouse::db::MOMENTS_FEATURE);
+    add_feature_rules(features, opt, "events", henhouse::db::EVENTS_FEATURE);
+    add_feature_rules(features, opt, "trend", henhouse::db::TREND_FEATURE);
+
+    const auto pairs = parse_pairs(opt);
+    const auto rollups = parse_rollups(opt);
+    const auto retention = parse_retention(opt);
+    const auto retention_interval = opt["retention_interval"].as<std::time_t>();
+
+    if(retention_interval <= 0) throw std::invalid_argument{"retention_interval must be greater than 0"};
+
+    const auto rings = parse_rings(opt, new_timeline_resolution);
 
     bf::create_directories(data_dir);
-    henhouse::threaded::server db{db_workers, data_dir, queue_size, cache_size, new_timeline_resolution};
+    henhouse::threaded::server db{
+        db_workers, 
+        data_dir, 
+        queue_size, 
+        cache_size, 
+        result_cache_size, 
+        new_timeline_resolution,
+        features,
+        rollups,
+        retention,
+        retention_interval,
+        rings,
+        mapped_budget * 1024 * 1024,
+        openers,
+        pairs,
+        hot_keys,
+        hot_window};
 
     std::cerr << "Started DB" << std::endl;
     std::cerr << "\tworkers: " << db_workers << std::endl;
     std::cerr << "\tqueue size: " << queue_size << std::endl;
     std::cerr << "\tcache size: " << cache_size << std::endl;
+    std::cerr << "\tresult cache size: " << result_cache_size << std::endl;
     std::cerr << "\ttimeline resolution: " << new_timeline_resolution << std::endl;
+    std::cerr << "\tfeature rules: " << features.size() << std::endl;
+    std::cerr << "\tpairs: " << pairs.size() << std::endl;
+    std::cerr << "\trollups: " << rollups.size() << std::endl;
+    std::cerr << "\tretention rules: " << retention.size() << std::endl;
+    std::cerr << "\tring rules: " << rings.size() << std::endl;
+    std::cerr << "\thot keys: " << hot_keys << " over " << hot_window << "s" << std::endl;
+    std::cerr << "\tmapped budget: " << mapped_budget << "MB" << std::endl;
+    std::cerr << "\topeners: " << openers << std::endl;
+
+    //collapses identical queries in flight
+    henhouse::threaded::single_flight flights{db, query_workers};
 
     //setup put endpoing that mimics graphite
     wangle::ServerBootstrap<henhouse::net::put_pipeline> put_server;
@@ -106,7 +301,7 @@ try
     options.shutdownOn = {SIGINT, SIGTERM};
     options.enableContentCompression = true;
     options.handlerFactories = proxygen::RequestHandlerChain()
-        .addThen<henhouse::net::query_handler_factory>(db, max_values)
+        .addThen<henhouse::net::query_handler_factory>(db, flights, values_window)
         .build();
 
     proxygen::HTTPServer query_server{std::move(options)};
@@ -117,7 +312,7 @@ try
     std::cerr << "\thttp2 port: " << http2_port << std::endl;
     std::cerr << "\tworkers: " << query_workers << std::endl;
     std::cerr << "\tcompression: " << true << std::endl;
-    std::cerr << "\tmax values: " << max_values << std::endl;
+    std::cerr << "\tvalues window: " << values_window << std::endl;
 
     //start services
     std::thread put_thread
@@ -0,0 +1,226 @@
+#include "service/hot_keys.hpp"
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace henhouse::threaded
+{
+    namespace
+    {
+        const std::time_t WINDOW_SLOTS = 10;
+    }
+
+    space_saving::space_saving(std::size_t capacity) : _capacity{capacity}
+    {
+        REQUIRE_GREATER(capacity, 0);
+        REQUIRE_LESS(capacity, NONE);
+
+        _counters.reserve(capacity);
+        _buckets.reserve(capacity);
+        _index.reserve(capacity);
+    }
+
+    void space_saving::add(const std::string& key, std::uint64_t weight)
+    {
+        const auto e = _index.find(key);
+        if(e != std::end(_index))
+        {
+            increment(e->second, weight);
+            return;
+        }
+
+        if(_counters.size() < _capacity)
+        {
+            const auto c = static_cast<index>(_counters.size());
+            _counters.push_back(counter{key, 0, NONE, NONE, NONE});
+            _index.emplace(key, c);
+            link(c, bucket_for(weight, NONE));
+            return;
+        }
+
+        //replace the smallest key, whose count becomes the error of the new key
+        CHECK_NOT_EQUAL(_min, NONE);
+        const auto c = _buckets[_min].first;
+        auto& smallest = _counters[c];
+
+        _index.erase(smallest.key);
+        smallest.key = key;
+        smallest.error = _buckets[_min].count;
+        _index.emplace(key, c);
+
+        increment(c, weight);
+
+        ENSURE_LESS_EQUAL(_counters.size(), _capacity);
+    }
+
+    void space_saving::increment(index c, std::uint64_t weight)
+    {
+        REQUIRE_LESS(c, _counters.size());
+        if(weight == 0) return;
+
+        const auto from = _counters[c].bucket;
+        const auto to = bucket_for(_buckets[from].count + weight, from);
+
+        unlink(c);
+        link(c, to);
+    }
+
+    //bucket with the count, created after the last bucket with a smaller count.
+    //The search starts at from, or the smallest bucket if from is NONE.
+    space_saving::index space_saving::bucket_for(std::uint64_t count, index from)
+    {
+        index at = NONE;
+        for(auto b = from == NONE ? _min : from; b != NONE && _buckets[b].count <= count; b = _buckets[b].next)
+            at = b;
+
+        if(at != NONE && _buckets[at].count == count) return at;
+        return new_bucket(count, at);
+    }
+
+    //inserts a bucket after the given one, or first if after is NONE
+    space_saving::index space_saving::new_bucket(std::uint64_t count, index after)
+    {
+        index b = NONE;
+        if(!_free_buckets.empty())
+        {
+            b = _free_buckets.back();
+            _free_buckets.pop_back();
+        }
+        else
+        {
+            b = static_cast<index>(_buckets.size());
+            _buckets.emplace_back();
+        }
+
+        const auto next = after == NONE ? _min : _buckets[after].next;
+        _buckets[b] = bucket{count, NONE, after, next};
+
+        if(next != NONE) _buckets[next].prev = b;
+        if(after != NONE) _buckets[after].next = b;
+        else _min = b;
+
+        return b;
+    }
+
+    void space_saving::link(index c, index b)
+    {
+        auto& x = _counters[c];
+        x.bucket = b;
+        x.prev = NONE;
+        x.next = _buckets[b].first;
+
+        if(x.next != NONE) _counters[x.next].prev = c;
+        _buckets[b].first = c;
+    }
+
+    //removes the counter from its bucket and frees the bucket once it is empty
+    void space_saving::unlink(index c)
+    {
+        const auto& x = _counters[c];
+        auto& b = _buckets[x.bucket];
+
+        if(x.prev != NONE) _counters[x.prev].next = x.next;
+        else b.first = x.next;
+        if(x.next != NONE) _counters[x.next].prev = x.prev;
+
+        if(b.first != NONE) return;
+
+        if(b.prev != NONE) _buckets[b.prev].next = b.next;
+        else _min = b.next;
+        if(b.next != NONE) _buckets[b.next].prev = b.prev;
+
+        _free_buckets.push_back(x.bucket);
+    }
+
+    void space_saving::merge_into(std::unordered_map<std::string, hitter>& m) const
+    {
+        for(const auto& c : _counters)
+        {
+            auto& h = m[c.key];
+            h.key = c.key;
+            h.count += _buckets[c.bucket].count;
+            h.error += c.error;
+        }
+    }
+
+    void space_saving::clear()
+    {
+        _counters.clear();
+        _buckets.clear();
+        _free_buckets.clear();
+        _index.clear();
+        _min = NONE;
+    }
+
+    hot_keys::hot_keys(std::size_t capacity, std::time_t window) :
+        _window{window},
+        _slot_size{std::max<std::time_t>(window / WINDOW_SLOTS, 1)},
+        _count{capacity},
+        _puts{capacity},
+        _slots(WINDOW_SLOTS, slot{0, space_saving{capacity}, space_saving{capacity}})
+    {
+        REQUIRE_GREATER(capacity, 0);
+        REQUIRE_GREATER(window, 0);
+    }
+
+    hot_keys::slot& hot_keys::current(std::time_t now)
+    {
+        const auto start = (now / _slot_size) * _slot_size;
+        auto& s = _slots[(now / _slot_size) % _slots.size()];
+
+        //slot is from an older window, reuse it
+        if(s.start != start)
+        {
+            s.start = start;
+            s.count.clear();
+            s.puts.clear();
+        }
+
+        return s;
+    }
+
+    void hot_keys::add(const std::string& key, std::int64_t c, std::time_t now)
+    {
+        const auto weight = static_cast<std::uint64_t>(std::llabs(c));
+
+        _count.add(key, weight);
+        _puts.add(key, 1);
+
+        auto& s = current(now);
+        s.count.add(key, weight);
+        s.puts.add(key, 1);
+    }
+
+    hitters hot_keys::top(hot_stat by, bool recent, std::size_t n, std::time_t now) const
+    {
+        std::unordered_map<std::string, hitter> m;
+
+        if(recent)
+        {
+            for(const auto& s : _slots)
+            {
+                if(s.start + _window <= now) continue;
+                if(by == hot_stat::count) s.count.merge_into(m);
+                else s.puts.merge_into(m);
+            }
+        }
+        else if(by == hot_stat::count) _count.merge_into(m);
+        else _puts.merge_into(m);
+
+        hitters h;
+        h.reserve(m.size());
+        for(auto& e : m) h.emplace_back(std::move(e.second));
+
+        sort_hitters(h, n);
+        return h;
+    }
+
+    void sort_hitters(hitters& h, std::size_t n)
+    {
+        const auto size = std::min(n, h.size());
+        std::partial_sort(std::begin(h), std::begin(h) + size, std::end(h),
+                [](const auto& a, const auto& b) { return a.count > b.count;});
+        h.resize(size);
+    }
+}
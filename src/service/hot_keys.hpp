@@ -0,0 +1,125 @@
+#ifndef HENHOUSE_HOT_KEYS_H
+#define HENHOUSE_HOT_KEYS_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace henhouse::threaded
+{
+    struct hitter
+    {
+        std::string key;
+        std::uint64_t count;    //estimated count, never less than the true count
+        std::uint64_t error;    //count overestimates the true count by at most this
+    };
+
+    using hitters = std::vector<hitter>;
+
+    /**
+     * Space-Saving sketch of the heaviest keys. Keeps counts for at most capacity
+     * keys. When a new key comes in and the sketch is full, the key with the
+     * smallest count is replaced and the new key inherits its count as error.
+     * Any key with a true count above total / capacity is guaranteed to be kept.
+     *
+     * Counters are kept in a stream summary, a list of buckets sorted by count
+     * where each bucket links the counters with its count. Adding one moves a
+     * counter to the next bucket and the smallest counter is the first bucket,
+     * so both are constant time. Adding a weight walks forward past the buckets
+     * with counts in between. Counters and buckets are reused once the sketch is 
+     * full, so the only allocation is the key of a new counter.
+     *
+     * This interface is NOT thread safe.
+     */
+    class space_saving
+    {
+        public:
+            explicit space_saving(std::size_t capacity);
+
+            void add(const std::string& key, std::uint64_t weight);
+
+            //adds the counts and errors of each key to the hitters
+            void merge_into(std::unordered_map<std::string, hitter>& m) const;
+
+            void clear();
+            std::size_t size() const { return _counters.size(); }
+
+        private:
+            using index = std::uint32_t;
+            static constexpr index NONE = UINT32_MAX;
+
+            struct counter
+            {
+                std::string key;
+                std::uint64_t error;
+                index bucket;
+                index prev;         //counters in the same bucket
+                index next;
+            };
+
+            struct bucket
+            {
+                std::uint64_t count;
+                index first;        //counter
+                index prev;         //buckets with smaller and larger counts
+                index next;
+            };
+
+            void increment(index c, std::uint64_t weight);
+            index bucket_for(std::uint64_t count, index from);
+            index new_bucket(std::uint64_t count, index after);
+            void link(index c, index b);
+            void unlink(index c);
+
+        private:
+            std::size_t _capacity;
+            std::vector<counter> _counters;
+            std::vector<bucket> _buckets;
+            std::vector<index> _free_buckets;
+            index _min = NONE;     //bucket with the smallest count
+            std::unordered_map<std::string, index> _index;
+    };
+
+    enum class hot_stat { count, puts };
+
+    /**
+     * Heaviest keys put into a worker, both by the sum of absolute values put
+     * and by the number of puts. Keys are tracked over the lifetime of the worker
+     * and over a sliding window of recent time split into slots.
+     *
+     * This interface is NOT thread safe.
+     */
+    class hot_keys
+    {
+        public:
+            hot_keys(std::size_t capacity, std::time_t window);
+
+            void add(const std::string& key, std::int64_t c, std::time_t now);
+
+            //top n keys over the lifetime, or the recent window if recent is true.
+            hitters top(hot_stat by, bool recent, std::size_t n, std::time_t now) const;
+
+        private:
+            struct slot
+            {
+                std::time_t start;
+                space_saving count;
+                space_saving puts;
+            };
+
+            slot& current(std::time_t now);
+
+        private:
+            std::time_t _window;
+            std::time_t _slot_size;
+            space_saving _count;
+            space_saving _puts;
+            std::vector<slot> _slots;
+    };
+
+    //sorts from largest count to smallest and keeps the first n
+    void sort_hitters(hitters& h, std::size_t n);
+}
+#endif
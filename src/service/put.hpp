@@ -15,6 +15,7 @@ namespace henhouse::net
 {
     typedef wangle::Pipeline<folly::IOBufQueue&, std::string> put_pipeline;
     const std::uint64_t TOLERANCE=60*10; //10 minute tolerance
+    const std::string OBSERVATION_TYPE = "h"; //value is an observation for the histogram
 
     class put_handler : public wangle::HandlerAdapter<std::string> 
     {
@@ -32,7 +33,8 @@ namespace henhouse::net
                 std::string key;
                 db::time_type t; 
                 std::int64_t c;
-                m >> key >> c >> t;
+                std::string type;
+                m >> key >> c >> t >> type;
 
                 if(key.empty()) return;
 
@@ -40,7 +42,8 @@ namespace henhouse::net
                 const auto now = std::time(nullptr);
                 if(t > (now + TOLERANCE)) return;
 
-                _db.put(key, t, c);
+                if(type == OBSERVATION_TYPE) _db.observe(key, t, c);
+                else _db.put(key, t, c);
             }
 
             virtual void readException(Context* ctx, folly::exception_wrapper e) override
@@ -2,6 +2,8 @@
 #define HENHOUSE_QUERY_SERV_H
 
 #include "service/threaded.hpp"
+#include "service/single_flight.hpp"
+#include "util/glob.hpp"
 
 #include <experimental/string_view>
 #include <sstream>
@@ -39,10 +41,6 @@ namespace henhouse::net
     {
         const int PREV_INDEX_OFFSET = 0; //index offset to start diff query
 
-        const std::size_t MAX_QUERY_SIZE = 10000;
-        const std::string QUERY_TOO_LARGE = 
-            "query size is too large. Max query must be under 10000 values";
-
         const std::string SMALL_PRECISION_STEP_ERROR  = 
             "cannot go beyond second precision, for step";
 
@@ -51,6 +49,18 @@ namespace henhouse::net
 
         const db::offset_type NO_OFFSET = 0;
 
+        //value of a stat the timeline does not maintain
+        const std::string NULL_VALUE = "null";
+
+        const std::string DEFAULT_QUANTILES = "0.5,0.9,0.99";
+
+        const std::size_t DEFAULT_TOP = 10;
+        const std::size_t MAX_TOP = 10000;
+
+        //keys a glob in a query may expand to, and keys listed by /keys
+        const std::size_t DEFAULT_KEYS = 1000;
+        const std::size_t MAX_KEYS = 10000;
+
         template<class key_func>
             void for_each_key(const stde::string_view &keys, key_func kf)
             {
@@ -67,18 +77,96 @@ namespace henhouse::net
                 }
             }
 
+        /**
+         * Like for_each_key but commas within the parentheses of a call like
+         * seriesByTag('dc=east','role=api') don't split the call.
+         */
+        template<class key_func>
+            void for_each_key_expr(const stde::string_view &keys, key_func kf)
+            {
+                int depth = 0;
+                char quote = 0;
+                std::size_t start = 0;
+                for(std::size_t i = 0; i <= keys.size(); i++)
+                {
+                    if(i < keys.size())
+                    {
+                        const auto c = keys[i];
+                        if(quote != 0) 
+                        {
+                            if(c == quote) quote = 0;
+                            continue;
+                        }
+
+                        if(depth > 0 && (c == '\'' || c == '"')) quote = c;
+                        else if(c == '(') depth++;
+                        else if(c == ')' && depth > 0) depth--;
+
+                        if(c != ',' || depth > 0) continue;
+                    }
+
+                    if(i > start) kf(keys.substr(start, i - start));
+                    start = i + 1;
+                }
+            }
+
         struct bad_request : public std::runtime_error 
         {
             bad_request(const std::string& error) : std::runtime_error{error}{}
         };
 
-    }
+        double parse_quantile(const std::string& s)
+        {
+            double q = 0;
+            try
+            {
+                q = boost::lexical_cast<double>(s);
+            }
+            catch(boost::bad_lexical_cast&)
+            {
+                throw bad_request{"quantile " + s + " is not a number"};
+            }
 
-    struct values_result
-    {
-        stde::string_view key;
-        std::vector<ht::diff_future> results;
-    };
+            if(q < 0.0 || q > 1.0) throw bad_request{"quantile " + s + " must be between 0 and 1"};
+            return q;
+        }
+
+        std::vector<double> parse_quantiles(const std::string& qs)
+        {
+            std::vector<double> r;
+            for_each_key(qs, [&](const stde::string_view& q) 
+            { 
+                r.push_back(parse_quantile(q.to_string()));
+            });
+
+            if(r.empty()) throw bad_request{"at least one quantile is required"};
+            return r;
+        }
+
+        std::size_t hash_combine(std::size_t h, std::size_t v)
+        {
+            return h ^ (v + 0x9e3779b9 + (h << 6) + (h >> 2));
+        }
+
+        //checks the etag against an If-None-Match header which may be a 
+        //list of strong or weak etags, or *
+        bool etag_matches(const std::string& if_none_match, const std::string& etag)
+        {
+            if(if_none_match.empty() || etag.empty()) return false;
+            if(ba::trim_copy(if_none_match) == "*") return true;
+
+            bool matches = false;
+            for_each_key(if_none_match, [&](const stde::string_view& t)
+            {
+                auto tag = ba::trim_copy(t.to_string());
+                if(ba::starts_with(tag, "W/")) tag.erase(0, 2);
+                if(tag == etag) matches = true;
+            });
+
+            return matches;
+        }
+
+    }
 
     struct summary_result
     {
@@ -89,17 +177,243 @@ namespace henhouse::net
     struct diff_result
     {
         stde::string_view key;
-        ht::diff_future result;
+        ht::diff_flight result;
     };
 
-    using key_values_result = std::vector<values_result>;
     using summary_results = std::vector<summary_result>;
     using diff_results = std::vector<diff_result>;
 
+    using extract_func_t = std::function<std::string(const hdb::diff_result& r)>;
+    using render_func_t = std::function<void(std::string& out, hdb::time_type t, const std::string& v)>;
+
+    /**
+     * The steps of a values query. Step i is the diff between left(i) and right(i).
+     * Steps are either even buckets from a to b or a discrete set of times
+     * provided by a payload. Even steps are computed on the fly so a query of
+     * any size takes constant memory.
+     */
+    class value_steps
+    {
+        public:
+            //even buckets based on step and segment size from a to b
+            value_steps(
+                    hdb::time_type a,
+                    hdb::time_type b,
+                    hdb::time_type step,
+                    hdb::time_type segment_size) :
+                _step{step}, _segment_size{segment_size}
+            {
+                if(step < 1) throw bad_request( SMALL_PRECISION_STEP_ERROR );
+                if(segment_size < 1) throw bad_request( SMALL_PRECISION_SIZE_ERROR );
+
+                _first = std::max(segment_size, a);
+                _last = std::max(step, b);
+
+                //all but last are even steps, last step ends at b
+                const auto e = _last - step;
+                _size = _first <= e ? ((e - _first) / step) + 2 : 1;
+
+                ENSURE_GREATER(_size, 0);
+            }
+
+            //discrete units specified in the payload
+            explicit value_steps(const folly::dynamic& payload)
+            try
+            {
+                REQUIRE(payload.isArray());
+                REQUIRE_GREATER(payload.size(), 1);
+
+                _times.reserve(payload.size());
+                for(const auto& t : payload)
+                    _times.push_back(t.getInt());
+
+                _size = _times.size() - 1;
+            }
+            catch(...)
+            {
+                throw bad_request("Expected the payload to be an array of integers");
+            }
+
+            std::size_t size() const { return _size; }
+
+            //time of the right edge of the last step
+            hdb::time_type end() const 
+            {
+                if(_times.empty()) return _last;
+                return *std::max_element(std::begin(_times), std::end(_times));
+            }
+
+            hdb::time_type left(std::size_t i) const
+            {
+                REQUIRE_LESS(i, _size);
+                if(!_times.empty()) return _times[i];
+                return _first - _segment_size + (i * _step);
+            }
+
+            hdb::time_type right(std::size_t i) const
+            {
+                REQUIRE_LESS(i, _size);
+                if(!_times.empty()) return _times[i + 1];
+                return i + 1 < _size ? _first + (i * _step) : _last;
+            }
+
+        private:
+            hdb::time_type _first = 0;
+            hdb::time_type _last = 0;
+            hdb::time_type _step = 1;
+            hdb::time_type _segment_size = 1;
+            std::size_t _size = 0;
+            std::vector<hdb::time_type> _times;
+    };
+
+    /**
+     * Streams the values of keys in fixed size windows of steps. While a window is
+     * rendered and sent to the client, the window after it is already being
+     * computed by the db workers. At most two windows are in flight so memory
+     * is bounded regardless of the size of the query. Steps are queried through
+     * the single flight layer so identical queries share the work.
+     *
+     * The response is either CSV, a line per key, or a JSON object where each
+     * key is an array of values.
+     */
+    class values_stream
+    {
+        public:
+            values_stream(
+                    threaded::single_flight& flights,
+                    std::vector<stde::string_view> keys,
+                    value_steps steps,
+                    const std::size_t window_size,
+                    render_func_t render_value,
+                    extract_func_t extract_value,
+                    bool is_csv) :
+                _flights{flights},
+                _keys{std::move(keys)},
+                _steps{std::move(steps)},
+                _window_size{window_size},
+                _render_value{std::move(render_value)},
+                _extract_value{std::move(extract_value)},
+                _is_csv{is_csv}
+            {
+                REQUIRE_GREATER(window_size, 0);
+                REQUIRE_GREATER(_steps.size(), 0);
+
+                _current = query_window(0, 0);
+                _next = query_window(_current.key, _current.end);
+            }
+
+            bool done() const { return _done; }
+
+            //renders the current window and queues the one after the next
+            void next(std::string& out)
+            {
+                REQUIRE_FALSE(_done);
+
+                if(_current.results.empty())
+                {
+                    if(!_is_csv) out.append(_keys.empty() ? "{}" : "}");
+                    _done = true;
+                    return;
+                }
+
+                render_window(out, _current);
+
+                _current = std::move(_next);
+                _next = query_window(_current.key, _current.end);
+            }
+
+        private:
+            struct window
+            {
+                std::size_t key = 0;
+                std::size_t begin = 0;
+                std::size_t end = 0;
+                std::vector<ht::diff_flight> results;
+            };
+
+            //query the db async for the steps of a key starting at begin
+            window query_window(std::size_t key, std::size_t begin)
+            {
+                //move on to next key when we are past the last step
+                if(begin >= _steps.size())
+                {
+                    key++;
+                    begin = 0;
+                }
+
+                window w;
+                w.key = key;
+                w.begin = begin;
+                w.end = begin;
+
+                if(key >= _keys.size()) return w;
+
+                w.end = std::min(begin + _window_size, _steps.size());
+                w.results.reserve(w.end - w.begin);
+
+                for(auto i = w.begin; i < w.end; i++)
+                    w.results.emplace_back(
+                            _flights.diff(_keys[key], _steps.left(i), _steps.right(i)));
+
+                return w;
+            }
+
+            void render_window(std::string& out, window& w)
+            {
+                REQUIRE_LESS(w.key, _keys.size());
+                const auto& key = _keys[w.key];
+
+                if(w.begin == 0)
+                {
+                    if(_is_csv)
+                    {
+                        out.append(key.data(), key.size());
+                        out.append(",");
+                    }
+                    else
+                    {
+                        out.append(w.key == 0 ? "{\"" : ",\"");
+                        out.append(key.data(), key.size());
+                        out.append("\":[");
+                    }
+                }
+
+                for(std::size_t i = 0; i < w.results.size(); i++)
+                {
+                    if(w.begin + i != 0) out.append(",");
+
+                    const auto& v = w.results[i].result.get();
+                    _render_value(out, v.a, _extract_value(v));
+                }
+
+                if(w.end == _steps.size()) out.append(_is_csv ? "\n" : "]");
+            }
+
+        private:
+            threaded::single_flight& _flights;
+            std::vector<stde::string_view> _keys;
+            value_steps _steps;
+            const std::size_t _window_size;
+            render_func_t _render_value;
+            extract_func_t _extract_value;
+            bool _is_csv;
+            bool _done = false;
+            window _current;
+            window _next;
+    };
+
+    using values_stream_ptr = std::unique_ptr<values_stream>;
+
     class query_request_handler : public proxygen::RequestHandler {
         public:
-            explicit query_request_handler(threaded::server& db, const std::size_t max_values) : 
-                RequestHandler{}, _db{db}, _max_values{max_values} {}
+            query_request_handler(
+                    threaded::server& db, 
+                    threaded::single_flight& flights, 
+                    const std::size_t window_size) : 
+                RequestHandler{}, _db{db}, _flights{flights}, _window_size{window_size} 
+            {
+                REQUIRE_GREATER(window_size, 0);
+            }
 
             void onRequest(std::unique_ptr<proxygen::HTTPMessage> req) noexcept override
             {
@@ -117,12 +431,31 @@ namespace henhouse::net
             {
                 REQUIRE(_req);
 
+                if(_body)
+                {
+                    const auto body = _body->moveToFbString();
+                    _payload.assign(body.data(), body.size());
+                    _body.reset();
+                }
+
                 if(_req->getPath() == "/summary")
                     on_summary(*_req);
                 else if(_req->getPath() == "/diff")
                     on_diff(*_req);
                 else if(_req->getPath() == "/values")
                     on_values(*_req);
+                else if(_req->getPath() == "/quantiles")
+                    on_quantiles(*_req);
+                else if(_req->getPath() == "/corr")
+                    on_corr(*_req);
+                else if(_req->getPath() == "/top")
+                    on_top(*_req);
+                else if(_req->getPath() == "/hot")
+                    on_hot(*_req);
+                else if(_req->getPath() == "/cache")
+                    on_cache(*_req);
+                else if(_req->getPath() == "/keys")
+                    on_keys(*_req);
                 else
                 {
                     proxygen::ResponseBuilder{downstream_}
@@ -166,13 +499,19 @@ namespace henhouse::net
                         return;
                     }
 
+                    keys = expand_keys(keys);
+
+                    //summary covers the whole timeline so it is never sealed
+                    const auto tag = etag(req, keys, std::numeric_limits<hdb::time_type>::max(), {});
+                    if(not_modified(req, tag)) return;
+
                     folly::dynamic out = folly::dynamic::array();
 
                     summary_results results;
 
                     for_each_key(keys, [&](const stde::string_view & key)
                     {
-                        summary_result r{key, _db.summary(key)};
+                        summary_result r{key, _db.summary(key, ht::cancel_token{_interest})};
                         results.emplace_back(std::move(r));
                     });
 
@@ -184,6 +523,7 @@ namespace henhouse::net
                         out.push_back(std::move(s));
                     }
 
+                    set_etag(rb, tag);
                     rb.body(folly::toJson(out))
                         .status(200, "OK")
                         .sendWithEOM();
@@ -219,10 +559,16 @@ namespace henhouse::net
 
                     if(a > b) std::swap(a, b);
 
+                    keys = expand_keys(keys);
+
+                    //a range ending now moves with the clock so it never gets an etag
+                    const auto tag = req.hasQueryParam("b") ? etag(req, keys, b, {a, b}) : std::string{};
+                    if(not_modified(req, tag)) return;
+
                     diff_results results;
                     for_each_key(keys, [&](const stde::string_view & key)
                     {
-                        diff_result r{key, _db.diff(key, a, b, NO_OFFSET)};
+                        diff_result r{key, _flights.diff(key, a, b)};
                         results.emplace_back(std::move(r));
                     });
 
@@ -232,10 +578,11 @@ namespace henhouse::net
                     {
                         folly::dynamic s = folly::dynamic::object
                             ("key", r.key.to_string())
-                            ("stats", diff(r.result.get()));
+                            ("stats", diff(r.result.result.get()));
                         out.push_back(std::move(s));
                     }
 
+                    set_etag(rb, tag);
                     rb.body(folly::toJson(out))
                         .status(200, "OK")
                         .sendWithEOM();
@@ -246,7 +593,6 @@ namespace henhouse::net
                 }
             }
 
-            using extract_func_t = std::function<std::string(const hdb::diff_result& r)>;
             extract_func_t get_extract_func(proxygen::HTTPMessage& req)
             {
                 using boost::lexical_cast;
@@ -257,18 +603,82 @@ namespace henhouse::net
                     f = [](const hdb::diff_result& r) { return lexical_cast<std::string>(r.variance);}; 
                 else if(req.hasQueryParam("agg"))
                     f = [](const hdb::diff_result& r) { return lexical_cast<std::string>(r.right.integral);};
+                else if(req.hasQueryParam("min"))
+                    f = [](const hdb::diff_result& r) 
+                    { 
+                        return r.features & hdb::EXTREMA_FEATURE ? lexical_cast<std::string>(r.min) : NULL_VALUE;
+                    };
+                else if(req.hasQueryParam("max"))
+                    f = [](const hdb::diff_result& r) 
+                    { 
+                        return r.features & hdb::EXTREMA_FEATURE ? lexical_cast<std::string>(r.max) : NULL_VALUE;
+                    };
+                else if(req.hasQueryParam("skew"))
+                    f = [](const hdb::diff_result& r) 
+                    { 
+                        return r.features & hdb::MOMENTS_FEATURE ? lexical_cast<std::string>(r.skew) : NULL_VALUE;
+                    };
+                else if(req.hasQueryParam("kurt"))
+                    f = [](const hdb::diff_result& r) 
+                    { 
+                        return r.features & hdb::MOMENTS_FEATURE ? lexical_cast<std::string>(r.kurt) : NULL_VALUE;
+                    };
+                else if(req.hasQueryParam("events"))
+                    f = [](const hdb::diff_result& r) 
+                    { 
+                        return r.features & hdb::EVENTS_FEATURE ? lexical_cast<std::string>(r.events) : NULL_VALUE;
+                    };
+                else if(req.hasQueryParam("event_mean"))
+                    f = [](const hdb::diff_result& r) 
+                    { 
+                        return r.features & hdb::EVENTS_FEATURE ? lexical_cast<std::string>(r.event_mean) : NULL_VALUE;
+                    };
+                else if(req.hasQueryParam("trend"))
+                    f = [](const hdb::diff_result& r) 
+                    { 
+                        return r.features & hdb::TREND_FEATURE ? lexical_cast<std::string>(r.slope) : NULL_VALUE;
+                    };
+                else if(req.hasQueryParam("q"))
+                {
+                    const auto q = parse_quantile(req.getQueryParam("q"));
+                    f = [q](const hdb::diff_result& r) 
+                    { 
+                        if(!(r.features & hdb::HISTOGRAM_FEATURE)) return NULL_VALUE;
+                        return r.histogram ? lexical_cast<std::string>(hdb::quantile(*r.histogram, q)) : "0";
+                    };
+                }
 
                 return f;
             }
 
-            void on_values(proxygen::HTTPMessage& req)
+            render_func_t get_render_func(proxygen::HTTPMessage& req, bool is_csv)
+            {
+                using boost::lexical_cast;
+                render_func_t f = [](std::string& out, hdb::time_type t, const std::string& v) 
+                { 
+                    out.append(v);
+                };
+
+                if(!is_csv && req.hasQueryParam("xy"))
+                    f = [](std::string& out, hdb::time_type t, const std::string& v)
+                    {
+                        out.append("{\"x\":");
+                        out.append(lexical_cast<std::string>(t));
+                        out.append(",\"y\":");
+                        out.append(v);
+                        out.append("}");
+                    };
+
+                return f;
+            }
+
+            void on_quantiles(proxygen::HTTPMessage& req) 
             {
                 using boost::lexical_cast;
                 auto rb = proxygen::ResponseBuilder{downstream_};
 
                 if(req.hasQueryParam("keys"))
                 {
-
                     auto keys = req.getQueryParam("keys");
 
                     if(keys.empty()) 
@@ -277,74 +687,378 @@ namespace henhouse::net
                         return;
                     }
 
-                    auto extract_func = get_extract_func(req);
+                    auto a = req.hasQueryParam("a") ? 
+                        lexical_cast<std::uint64_t>(req.getQueryParam("a")) :
+                        0;
 
-                    bool is_csv = req.hasQueryParam("csv");
+                    auto b = req.hasQueryParam("b") ? 
+                        lexical_cast<std::uint64_t>(req.getQueryParam("b")) : 
+                        std::time(0);
 
-                    auto render_func = !is_csv && req.hasQueryParam("xy") ? 
-                        [](proxygen::ResponseBuilder& rb, hdb::time_type t, const std::string& v) -> void 
-                        {
-                            rb.body("{\"x\":");
-                            rb.body(lexical_cast<std::string>(t));
-                            rb.body(",\"y\":");
-                            rb.body(v);
-                            rb.body("}");
-                        } :
-                    [](proxygen::ResponseBuilder& rb, hdb::time_type t, const std::string& v) -> void 
-                    {
-                        rb.body(v);
-                    };
+                    if(a > b) std::swap(a, b);
 
-                    rb.status(200, "OK");
+                    const auto qs = parse_quantiles(
+                            req.hasQueryParam("q") ? req.getQueryParam("q") : DEFAULT_QUANTILES);
 
-                    //first query the values asynchronously
-                    key_values_result results;
+                    //a range ending now moves with the clock so it never gets an etag
+                    const auto tag = req.hasQueryParam("b") ? etag(req, keys, b, {a, b}) : std::string{};
+                    if(not_modified(req, tag)) return;
 
-                    if(_body)
+                    //quantiles come from the histogram of the diff
+                    diff_results results;
+                    for_each_key(keys, [&](const stde::string_view & key)
                     {
-                        const auto body = _body->moveToFbString();
-                        const auto payload = folly::parseJson(body);
+                        diff_result r{key, _flights.diff(key, a, b)};
+                        results.emplace_back(std::move(r));
+                    });
 
-                        if(!payload.isArray() || payload.size() < 2)
-                        {
-                            rb.status(400, "Payload must be an array of numbers of at least two numbers").sendWithEOM();
-                            return;
-                        }
+                    folly::dynamic out = folly::dynamic::array();
 
-                        for_each_key(keys, [&](const stde::string_view& key) 
-                        {
-                            results.emplace_back(query_values(key, payload));
-                        });
+                    for(auto& r: results)
+                    {
+                        folly::dynamic s = folly::dynamic::object
+                            ("key", r.key.to_string())
+                            ("stats", quantiles(r.result.result.get(), qs));
+                        out.push_back(std::move(s));
                     }
-                    else
+
+                    set_etag(rb, tag);
+                    rb.body(folly::toJson(out))
+                        .status(200, "OK")
+                        .sendWithEOM();
+                }
+                else
+                {
+                    rb.status(400, "Missing keys parameter").sendWithEOM();
+                }
+            }
+
+            void on_corr(proxygen::HTTPMessage& req) 
+            {
+                using boost::lexical_cast;
+                auto rb = proxygen::ResponseBuilder{downstream_};
+
+                if(!req.hasQueryParam("x") || !req.hasQueryParam("y"))
+                {
+                    rb.status(400, "Missing x or y parameter").sendWithEOM();
+                    return;
+                }
+
+                const auto x = req.getQueryParam("x");
+                const auto y = req.getQueryParam("y");
+
+                if(!_db.has_pair(x, y))
+                {
+                    rb.status(404, "The pair x,y is not declared").sendWithEOM();
+                    return;
+                }
+
+                auto a = req.hasQueryParam("a") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("a")) :
+                    0;
+
+                auto b = req.hasQueryParam("b") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("b")) : 
+                    std::time(0);
+
+                if(a > b) std::swap(a, b);
+
+                auto r = _db.corr(x, y, a, b, ht::cancel_token{_interest});
+
+                folly::dynamic out = folly::dynamic::object
+                    ("x", x)
+                    ("y", y)
+                    ("stats", corr(r.get()));
+
+                rb.body(folly::toJson(out))
+                    .status(200, "OK")
+                    .sendWithEOM();
+            }
+
+            void on_top(proxygen::HTTPMessage& req) 
+            {
+                using boost::lexical_cast;
+                auto rb = proxygen::ResponseBuilder{downstream_};
+
+                const auto glob = req.hasQueryParam("keys") ? req.getQueryParam("keys") : "*";
+
+                auto a = req.hasQueryParam("a") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("a")) :
+                    0;
+
+                auto b = req.hasQueryParam("b") ? 
+                    lexical_cast<std::uint64_t>(req.getQueryParam("b")) : 
+                    std::time(0);
+
+                if(a > b) std::swap(a, b);
+
+                const auto n = req.hasQueryParam("n") ? 
+                    lexical_cast<std::size_t>(req.getQueryParam("n")) : 
+                    DEFAULT_TOP;
+
+                if(n == 0 || n > MAX_TOP) 
+                    throw bad_request{"n must be between 1 and " + lexical_cast<std::string>(MAX_TOP)};
+
+                auto by = hdb::top_stat::sum;
+                if(req.hasQueryParam("by"))
+                {
+                    const auto stat = req.getQueryParam("by");
+                    if(stat == "mean") by = hdb::top_stat::mean;
+                    else if(stat == "var") by = hdb::top_stat::variance;
+                    else if(stat != "sum") throw bad_request{"by must be one of sum, mean, or var"};
+                }
+
+                //merge the top of each worker
+                auto partials = _db.top(glob, a, b, n, by, ht::cancel_token{_interest});
+
+                hdb::top_items top;
+                for(auto& p : partials)
+                    for(auto& i : p.get())
+                        hdb::push_top(top, n, std::move(i));
+
+                hdb::sort_top(top);
+
+                folly::dynamic out = folly::dynamic::array();
+                for(const auto& i : top)
+                {
+                    folly::dynamic s = folly::dynamic::object
+                        ("key", i.key)
+                        ("stats", diff(i.result));
+                    out.push_back(std::move(s));
+                }
+
+                rb.body(folly::toJson(out))
+                    .status(200, "OK")
+                    .sendWithEOM();
+            }
+
+            void on_hot(proxygen::HTTPMessage& req) 
+            {
+                using boost::lexical_cast;
+                auto rb = proxygen::ResponseBuilder{downstream_};
+
+                const auto n = req.hasQueryParam("n") ? 
+                    lexical_cast<std::size_t>(req.getQueryParam("n")) : 
+                    DEFAULT_TOP;
+
+                if(n == 0 || n > MAX_TOP) 
+                    throw bad_request{"n must be between 1 and " + lexical_cast<std::string>(MAX_TOP)};
+
+                auto by = ht::hot_stat::count;
+                if(req.hasQueryParam("by"))
+                {
+                    const auto stat = req.getQueryParam("by");
+                    if(stat == "puts") by = ht::hot_stat::puts;
+                    else if(stat != "count") throw bad_request{"by must be one of count or puts"};
+                }
+
+                bool recent = true;
+                if(req.hasQueryParam("window"))
+                {
+                    const auto window = req.getQueryParam("window");
+                    if(window == "lifetime") recent = false;
+                    else if(window != "recent") throw bad_request{"window must be one of recent or lifetime"};
+                }
+
+                //keys are owned by one worker so the partial results never overlap
+                auto partials = _db.hot(by, recent, n, ht::cancel_token{_interest});
+
+                ht::hitters hot;
+                for(auto& p : partials)
+                    for(auto& h : p.get())
+                        hot.push_back(std::move(h));
+
+                ht::sort_hitters(hot, n);
+
+                const auto window = _db.hot_window();
+
+                folly::dynamic out = folly::dynamic::array();
+                for(const auto& h : hot)
+                {
+                    folly::dynamic s = folly::dynamic::object
+                        ("key", h.key)
+                        ("count", static_cast<std::int64_t>(h.count))
+                        ("error", static_cast<std::int64_t>(h.error));
+
+                    if(recent) s["rate"] = static_cast<double>(h.count) / window;
+                    out.push_back(std::move(s));
+                }
+
+                rb.body(folly::toJson(out))
+                    .status(200, "OK")
+                    .sendWithEOM();
+            }
+
+            void on_cache(proxygen::HTTPMessage&) 
+            {
+                const auto s = _db.cache_stats();
+                const auto lookups = s.hits + s.misses;
+
+                folly::dynamic out = folly::dynamic::object
+                    ("hits", static_cast<std::int64_t>(s.hits))
+                    ("misses", static_cast<std::int64_t>(s.misses))
+                    ("evictions", static_cast<std::int64_t>(s.evictions))
+                    ("size", static_cast<std::int64_t>(s.size))
+                    ("hit_rate", lookups > 0 ? static_cast<double>(s.hits) / lookups : 0.0);
+
+                proxygen::ResponseBuilder{downstream_}
+                    .body(folly::toJson(out))
+                    .status(200, "OK")
+                    .sendWithEOM();
+            }
+
+            void on_keys(proxygen::HTTPMessage& req) 
+            {
+                using boost::lexical_cast;
+
+                const auto glob = req.hasQueryParam("match") ? req.getQueryParam("match") : "*";
+
+                const auto n = req.hasQueryParam("n") ? 
+                    lexical_cast<std::size_t>(req.getQueryParam("n")) : 
+                    DEFAULT_KEYS;
+
+                if(n == 0 || n > MAX_KEYS) 
+                    throw bad_request{"n must be between 1 and " + lexical_cast<std::string>(MAX_KEYS)};
+
+                hdb::key_list keys;
+                if(!find_tagged(glob, n, keys)) keys = match_keys(glob, n);
+
+                folly::dynamic out = folly::dynamic::array();
+                for(const auto& k : keys) out.push_back(k);
+
+                proxygen::ResponseBuilder{downstream_}
+                    .body(folly::toJson(out))
+                    .status(200, "OK")
+                    .sendWithEOM();
+            }
+
+            //keys of the series matching a seriesByTag call, or false if key is not one
+            bool find_tagged(const stde::string_view& key, std::size_t max, hdb::key_list& keys) const
+            try
+            {
+                hdb::tag_exprs exprs;
+                if(!hdb::parse_series_by_tag(key, exprs)) return false;
+
+                keys = _db.tagged(exprs, max);
+                return true;
+            }
+            catch(std::invalid_argument& e)
+            {
+                throw bad_request{e.what()};
+            }
+
+            //keys in the catalog matching the glob
+            hdb::key_list match_keys(const stde::string_view& glob, std::size_t max) const
+            try
+            {
+                return _db.keys(glob, max);
+            }
+            catch(std::invalid_argument& e)
+            {
+                throw bad_request{e.what()};
+            }
+
+            /**
+             * Replaces each glob in the comma separated keys with the keys in the
+             * catalog matching it, and each seriesByTag call with the keys of the
+             * series matching it. Other keys are kept as they are.
+             */
+            std::string expand_keys(const std::string& keys) const
+            {
+                using boost::lexical_cast;
+
+                if(keys.find_first_of("*?") == std::string::npos && 
+                        keys.find("seriesByTag(") == std::string::npos) return keys;
+
+                std::string expanded;
+                std::size_t count = 0;
+                auto append = [&](const stde::string_view& key)
+                {
+                    if(!expanded.empty()) expanded += ',';
+                    expanded.append(key.data(), key.size());
+                    count++;
+                };
+
+                for_each_key_expr(keys, [&](const stde::string_view& key)
+                {
+                    //one more than allowed so too many matches are detected
+                    const auto left = MAX_KEYS + 1 - std::min(count, MAX_KEYS);
+
+                    hdb::key_list tagged;
+                    if(find_tagged(key, left, tagged))
+                    {
+                        for(const auto& k : tagged) append(k);
+                        return;
+                    }
+
+                    if(!util::is_glob(key)) 
                     {
-                        auto a = req.hasQueryParam("a") ?
-                            lexical_cast<std::uint64_t>(req.getQueryParam("a")) :
-                            0;
+                        append(key);
+                        return;
+                    }
 
-                        auto b = req.hasQueryParam("b") ?
-                            lexical_cast<std::uint64_t>(req.getQueryParam("b")) :
-                            std::time(0);
+                    for(const auto& k : match_keys(key, left)) append(k);
+                });
 
-                        if(a > b) std::swap(a, b);
+                if(count > MAX_KEYS) 
+                    throw bad_request{"keys match more than " + lexical_cast<std::string>(MAX_KEYS) + " timelines"};
 
-                        auto step = req.hasQueryParam("step") ?
-                            lexical_cast<std::uint64_t>(req.getQueryParam("step")) :
-                            1;
+                return expanded;
+            }
+
+            void on_values(proxygen::HTTPMessage& req)
+            {
+                using boost::lexical_cast;
+                auto rb = proxygen::ResponseBuilder{downstream_};
 
-                        auto segment_size = req.hasQueryParam("size") ?
-                            lexical_cast<std::uint64_t>(req.getQueryParam("size")) :
-                            step;
+                if(req.hasQueryParam("keys"))
+                {
+                    //keys are kept with the handler since the stream outlives this call
+                    _keys = req.getQueryParam("keys");
 
-                        for_each_key(keys, [&](const stde::string_view& key)
-                        {
-                            results.emplace_back(query_values(key, a, b, step, segment_size));
-                        });
+                    if(_keys.empty()) 
+                    {
+                        rb.status(400, "The Keys parameter must be a comma separated list").sendWithEOM();
+                        return;
                     }
 
-                    //render values as results come in
-                    render_values(results, rb, keys, render_func, extract_func, is_csv);
-                    rb.sendWithEOM();
+                    auto extract_func = get_extract_func(req);
+
+                    bool is_csv = req.hasQueryParam("csv");
+                    auto render_func = get_render_func(req, is_csv);
+
+                    _keys = expand_keys(_keys);
+
+                    std::vector<stde::string_view> keys;
+                    for_each_key(_keys, [&](const stde::string_view& key) 
+                    {
+                        keys.push_back(key);
+                    });
+
+                    //validate the whole query before any of the response is sent
+                    auto steps = query_steps(req);
+
+                    //steps ending now move with the clock so they never get an etag
+                    const bool pinned = !_payload.empty() || req.hasQueryParam("b");
+                    const auto tag = pinned ? 
+                        etag(req, _keys, steps.end(), {steps.left(0), steps.right(0), steps.end(), steps.size()}) : 
+                        std::string{};
+                    if(not_modified(req, tag)) return;
+
+                    //values are queried asynchronously and streamed as they come in
+                    _values = std::make_unique<values_stream>(
+                            _flights, 
+                            std::move(keys), 
+                            std::move(steps), 
+                            _window_size, 
+                            render_func, 
+                            extract_func, 
+                            is_csv);
+
+                    set_etag(rb, tag);
+                    rb.status(200, "OK").send();
+
+                    stream_values();
                 }
                 else
                 {
@@ -352,6 +1066,138 @@ namespace henhouse::net
                 }
             }
 
+            value_steps query_steps(proxygen::HTTPMessage& req)
+            {
+                using boost::lexical_cast;
+
+                //query values based on discrete units specified in the payload
+                if(!_payload.empty())
+                {
+                    const auto payload = folly::parseJson(_payload);
+
+                    if(!payload.isArray() || payload.size() < 2)
+                        throw bad_request("Payload must be an array of numbers of at least two numbers");
+
+                    return value_steps{payload};
+                }
+
+                //query even buckets based on step and segment size from a to b
+                auto a = req.hasQueryParam("a") ?
+                    lexical_cast<std::uint64_t>(req.getQueryParam("a")) :
+                    0;
+
+                auto b = req.hasQueryParam("b") ?
+                    lexical_cast<std::uint64_t>(req.getQueryParam("b")) :
+                    std::time(0);
+
+                if(a > b) std::swap(a, b);
+
+                auto step = req.hasQueryParam("step") ?
+                    lexical_cast<std::uint64_t>(req.getQueryParam("step")) :
+                    1;
+
+                auto segment_size = req.hasQueryParam("size") ?
+                    lexical_cast<std::uint64_t>(req.getQueryParam("size")) :
+                    step;
+
+                return value_steps{a, b, step, segment_size};
+            }
+
+            /**
+             * The etag of a query combines the query, the resolved range, and the 
+             * version of each key up to time t. Sealed ranges have constant versions 
+             * so their etags are stable, even across restarts. Returns an empty etag 
+             * if any of the keys can't be versioned.
+             */
+            std::string etag(
+                    proxygen::HTTPMessage& req, 
+                    const std::string& keys, 
+                    hdb::time_type t, 
+                    std::initializer_list<std::uint64_t> range)
+            try
+            {
+                std::vector<ht::version_future> versions;
+                for_each_key(keys, [&](const stde::string_view& key)
+                {
+                    versions.emplace_back(_db.version(key, t, ht::cancel_token{_interest}));
+                });
+
+                auto h = std::hash<std::string>{}(req.getPath());
+                h = hash_combine(h, std::hash<std::string>{}(req.getQueryString()));
+                h = hash_combine(h, std::hash<std::string>{}(_payload));
+
+                for(const auto r : range)
+                    h = hash_combine(h, std::hash<std::uint64_t>{}(r));
+
+                for(auto& v : versions) 
+                    h = hash_combine(h, v.get());
+
+                std::stringstream tag;
+                tag << '"' << std::hex << h << '"';
+                return tag.str();
+            }
+            catch(std::exception& e)
+            {
+                return "";
+            }
+
+            void set_etag(proxygen::ResponseBuilder& rb, const std::string& tag)
+            {
+                if(!tag.empty()) rb.header("ETag", tag);
+            }
+
+            //responds with 304 if the client already has the result
+            bool not_modified(proxygen::HTTPMessage& req, const std::string& tag)
+            {
+                const auto& if_none_match = req.getHeaders().getSingleOrEmpty("If-None-Match");
+                if(!etag_matches(if_none_match, tag)) return false;
+
+                proxygen::ResponseBuilder{downstream_}
+                    .status(304, "Not Modified")
+                    .header("ETag", tag)
+                    .sendWithEOM();
+
+                return true;
+            }
+
+            //sends windows of values until done or the client can't keep up.
+            //When egress is paused we stop and continue once it is resumed.
+            void stream_values() noexcept
+            try
+            {
+                while(_values && !_egress_paused)
+                {
+                    std::string out;
+                    _values->next(out);
+
+                    auto rb = proxygen::ResponseBuilder{downstream_};
+                    if(!out.empty()) rb.body(std::move(out));
+
+                    if(_values->done())
+                    {
+                        //handler may be deleted once EOM is sent
+                        _values.reset();
+                        rb.sendWithEOM();
+                        return;
+                    }
+
+                    rb.send();
+                }
+            }
+            catch(std::exception& e)
+            {
+                //headers are already sent so all we can do is abort
+                std::cerr << "error streaming values: " << e.what() << std::endl;
+                _values.reset();
+                downstream_->sendAbort();
+            }
+            catch(...)
+            {
+                std::cerr << "unknown error streaming values" << std::endl;
+                _values.reset();
+                downstream_->sendAbort();
+            }
+
             void onUpgrade(proxygen::UpgradeProtocol proto) noexcept override {}
 
             void requestComplete() noexcept override 
@@ -359,11 +1205,24 @@ namespace henhouse::net
                 delete this;
             }
 
+            //Deleting the handler releases the interest in any queued requests 
+            //which cancels them.
             void onError(proxygen::ProxygenError err) noexcept override 
             { 
                 delete this;
             }
 
+            void onEgressPaused() noexcept override
+            {
+                _egress_paused = true;
+            }
+
+            void onEgressResumed() noexcept override
+            {
+                _egress_paused = false;
+                stream_values();
+            }
+
             folly::dynamic diff(const db::diff_result& r)
             {
 
@@ -381,6 +1240,56 @@ namespace henhouse::net
                      folly::dynamic::object
                      ("val", r.right.value)
                      ("agg", r.right.integral));
+
+                if(r.features & db::EXTREMA_FEATURE)
+                {
+                    o["min"] = r.min;
+                    o["max"] = r.max;
+                }
+                if(r.features & db::MOMENTS_FEATURE)
+                {
+                    o["skew"] = r.skew;
+                    o["kurt"] = r.kurt;
+                }
+                if(r.features & db::EVENTS_FEATURE)
+                {
+                    o["events"] = r.events;
+                    o["event_mean"] = r.event_mean;
+                }
+                if(r.features & db::TREND_FEATURE)
+                {
+                    o["slope"] = r.slope;
+                    o["intercept"] = r.intercept;
+                }
+                return o;
+            }
+
+            folly::dynamic quantiles(const db::diff_result& r, const std::vector<double>& qs)
+            {
+                if(!(r.features & db::HISTOGRAM_FEATURE)) return nullptr;
+
+                const auto h = r.histogram ? *r.histogram : db::histogram_bins{};
+
+                folly::dynamic values = folly::dynamic::array();
+                for(auto q : qs)
+                    values.push_back(folly::dynamic::object("q", q)("value", db::quantile(h, q)));
+
+                folly::dynamic o = folly::dynamic::object
+                    ("observations", db::observations(h))
+                    ("resolution", r.resolution)
+                    ("quantiles", values);
+                return o;
+            }
+
+            folly::dynamic corr(const db::corr_result& r)
+            {
+                folly::dynamic o = folly::dynamic::object
+                    ("mean_x", r.mean_x)
+                    ("mean_y", r.mean_y)
+                    ("covariance", r.covariance)
+                    ("correlation", r.correlation)
+                    ("points", r.size)
+                    ("resolution", r.resolution);
                 return o;
             }
 
@@ -397,153 +1306,27 @@ namespace henhouse::net
                 return o;
             }
 
-            template<typename render_func, typename extract_func>
-                void render_values(
-                        key_values_result& results,
-                        proxygen::ResponseBuilder& rb,
-                        const std::string& keys, 
-                        render_func render_value,
-                        extract_func extract_value,
-                        bool is_csv)
-                {
-                    //render the result depending on csv vs json
-                    if(is_csv) 
-                    {
-                        for(auto& r: results)
-                        {
-                            rb.body(r.key.to_string());
-                            rb.body(",");
-                            render_key_values(rb, r, render_value, extract_value);
-                            rb.body("\n");
-                        };
-                    }
-                    else
-                    {
-                        rb.body("{");
-                        int c = 0;
-                        for(auto& r: results)
-                        {
-                            if(c != 0) rb.body(",");
-                            c++;
-
-                            rb.body("\"");
-                            rb.body(r.key.to_string());
-                            rb.body("\":[");
-                            render_key_values(rb, r, render_value, extract_value);
-                            rb.body("]");
-                        };
-                        rb.body("}");
-                    }
-
-                }
-
-                //query even buckets based on step and segment size from a to b
-                values_result query_values(
-                        const stde::string_view& key, 
-                        hdb::time_type a, 
-                        hdb::time_type b,
-                        hdb::time_type step,
-                        hdb::time_type segment_size)
-                {
-                    if(step < 1) throw bad_request( SMALL_PRECISION_STEP_ERROR );
-                    if(segment_size < 1) throw bad_request( SMALL_PRECISION_SIZE_ERROR );
-
-                    a = std::max(segment_size, a);
-                    b = std::max(step, b);
-
-                    //output all but last
-                    auto s = a - segment_size;
-                    const auto e = b - step;
-
-                    const auto query_size = (b - a) / step;
-                    if(query_size > MAX_QUERY_SIZE) throw bad_request( QUERY_TOO_LARGE );
-
-                    //create place to put future results 
-                    values_result r;
-                    r.key = key;
-                    r.results.reserve(query_size);
-
-                    //query db async storing the futures
-                    for(; a <= e; s+=step, a+=step)
-                        r.results.emplace_back(_db.diff(key, s, a, PREV_INDEX_OFFSET));
-
-                    //query last
-                    r.results.emplace_back(_db.diff(key, s, b, PREV_INDEX_OFFSET));
-
-                    return r;
-                }
-
-                //query values based on discrete units specified in the payload
-                values_result query_values(
-                        const stde::string_view& key,
-                        const folly::dynamic& payload)
-                try
-                {
-                    REQUIRE(payload.isArray());
-                    REQUIRE_GREATER(payload.size(), 1);
-
-                    //create place to put future results
-                    values_result r;
-                    r.key = key;
-                    r.results.reserve(payload.size() - 1);
-
-                    //query db async storing the futures
-
-                    auto s =  payload[0].getInt();
-                    for(int i = 1; i < payload.size(); i++)
-                    {
-                        const auto e = payload[i].getInt();
-                        r.results.emplace_back(_db.diff(key, s, e, PREV_INDEX_OFFSET));
-                        s = e;
-                    }
-
-                    return r;
-                }
-                catch(...)
-                {
-                    throw bad_request("Expected the payload to be an array of integers");
-                }
-
-            template<typename render_func, typename extract_func>
-                void render_key_values(
-                        proxygen::ResponseBuilder& rb,
-                        values_result& r,
-                        render_func render_value,
-                        extract_func extract_value)
-                {
-                    REQUIRE_FALSE(r.key.empty());
-                    REQUIRE_FALSE(r.results.empty());
-
-                    //process results and output to client
-                    int c = 0;
-                    for(size_t i = 0; i < r.results.size() - 1; i++, c++) 
-                    {
-                        const auto v = r.results[i].get(); 
-
-                        render_value(rb, v.a, extract_value(v));
-                        rb.body(",");
-                        //50 here should roughly be 1k for xy request, though likely larger.
-                        //TODO don't use RequestBuilder, do it yourself.
-                        if(c % 50 == 0) rb.send();
-                    }
-
-                    //output last
-                    const auto lv = r.results[r.results.size() -1].get();
-                    render_value(rb, lv.a, extract_value(lv));
-                }
-
         private:
             threaded::server& _db;
-            const std::size_t _max_values;
+            threaded::single_flight& _flights;
+            const std::size_t _window_size;
             std::unique_ptr<folly::IOBuf> _body;
             std::unique_ptr<proxygen::HTTPMessage> _req;
+            std::string _payload;
+            std::string _keys;
+            values_stream_ptr _values;
+            bool _egress_paused = false;
+            ht::interest_ptr _interest = ht::make_interest();
     };
 
     class query_handler_factory : public proxygen::RequestHandlerFactory 
     {
         public:
-            query_handler_factory(threaded::server& db, const std::size_t max_values) : 
-                proxygen::RequestHandlerFactory{}, _db{db}, _max_values{max_values} {}
+            query_handler_factory(
+                    threaded::server& db, 
+                    threaded::single_flight& flights, 
+                    const std::size_t window_size) : 
+                proxygen::RequestHandlerFactory{}, _db{db}, _flights{flights}, _window_size{window_size} {}
 
         public:
 
@@ -551,7 +1334,7 @@ namespace henhouse::net
                     proxygen::RequestHandler* r, 
                     proxygen::HTTPMessage* m) noexcept override 
             {
-                return new query_request_handler(_db, _max_values);
+                return new query_request_handler(_db, _flights, _window_size);
             }
 
             void onServerStart(folly::EventBase* evb) noexcept { } 
@@ -559,7 +1342,8 @@ namespace henhouse::net
 
         private:
             threaded::server& _db;
-            const std::size_t _max_values;
+            threaded::single_flight& _flights;
+            const std::size_t _window_size;
     };
 }
 #endif
@@ -0,0 +1,91 @@
+#include "service/single_flight.hpp"
+
+#include <chrono>
+#include <functional>
+
+namespace henhouse::threaded
+{
+    namespace
+    {
+        const std::size_t MIN_SWEEP_SIZE = 1024;
+        const db::offset_type NO_OFFSET = 0;
+
+        bool is_ready(const shared_diff_future& f)
+        {
+            return f.wait_for(std::chrono::seconds::zero()) == std::future_status::ready;
+        }
+    }
+
+    std::size_t single_flight::flight_key_hash::operator()(const flight_key& k) const
+    {
+        auto h = std::hash<std::string>{}(k.key);
+        h ^= std::hash<db::time_type>{}(k.a) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h ^= std::hash<db::time_type>{}(k.b) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+
+    single_flight::single_flight(server& db, const std::size_t total_shards) : _db{db}
+    {
+        REQUIRE_GREATER(total_shards, 0);
+
+        _shards.reserve(total_shards);
+        for(std::size_t i = 0; i < total_shards; i++)
+        {
+            auto s = std::make_unique<shard>();
+            s->sweep_size = MIN_SWEEP_SIZE;
+            _shards.emplace_back(std::move(s));
+        }
+
+        ENSURE_EQUAL(_shards.size(), total_shards);
+    }
+
+    diff_flight single_flight::diff(const stde::string_view& key, db::time_type a, db::time_type b)
+    {
+        flight_key k;
+        k.key.reserve(key.size());
+        db::sanatize_key(k.key, key);
+        k.a = a;
+        k.b = b;
+
+        const auto h = flight_key_hash{}(k);
+        auto& s = *_shards[h % _shards.size()];
+
+        std::lock_guard<std::mutex> lock{s.mutex};
+
+        //join the flight if it is still pending and somebody is waiting on it
+        auto p = s.in_flight.find(k);
+        if(p != std::end(s.in_flight))
+        {
+            auto interest = p->second.interest.lock();
+            if(interest && !is_ready(p->second.result))
+                return diff_flight{p->second.result, std::move(interest)};
+        }
+
+        auto interest = make_interest();
+        auto result = _db.diff(k.key, a, b, NO_OFFSET, cancel_token{interest}).share();
+
+        if(p != std::end(s.in_flight)) 
+            p->second = pending{result, interest};
+        else 
+            s.in_flight.emplace(std::move(k), pending{result, interest});
+
+        if(s.in_flight.size() >= s.sweep_size) sweep(s);
+
+        return diff_flight{std::move(result), std::move(interest)};
+    }
+
+    //Removes flights that are done or that nobody waits on anymore. 
+    //Sweeps happen when the shard doubles in size so the cost is amortized.
+    void single_flight::sweep(shard& s)
+    {
+        for(auto p = std::begin(s.in_flight); p != std::end(s.in_flight);)
+        {
+            if(p->second.interest.expired() || is_ready(p->second.result))
+                p = s.in_flight.erase(p);
+            else 
+                p++;
+        }
+
+        s.sweep_size = std::max(MIN_SWEEP_SIZE, s.in_flight.size() * 2);
+    }
+}
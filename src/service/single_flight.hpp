@@ -0,0 +1,85 @@
+#ifndef HENHOUSE_SINGLE_FLIGHT_H
+#define HENHOUSE_SINGLE_FLIGHT_H
+
+#include "service/threaded.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace henhouse::threaded
+{
+    using shared_diff_future = std::shared_future<db::diff_result>;
+
+    /**
+     * A diff shared by everyone asking the same question at the same time.
+     * Holding the flight keeps the queued request alive. Every holder shares 
+     * the same interest, so one holder letting go, like a client disconnecting, 
+     * doesn't cancel it for the rest. Once every holder lets go the request is 
+     * cancelled, and a cancelled flight is never joined again.
+     */
+    struct diff_flight
+    {
+        shared_diff_future result;
+        interest_ptr interest;
+    };
+
+    /**
+     * Sits in front of the server and collapses identical diff queries that are 
+     * in flight at the same time into one request to the workers. Queries are 
+     * identical if they have the same sanitized key and time range.
+     *
+     * This interface is thread safe. Flights are sharded by key to keep 
+     * contention between query threads low.
+     */
+    class single_flight
+    {
+        public:
+            single_flight(server& db, const std::size_t shards);
+
+            diff_flight diff(const stde::string_view& key, db::time_type a, db::time_type b);
+
+        private:
+            struct flight_key
+            {
+                std::string key;
+                db::time_type a;
+                db::time_type b;
+
+                bool operator==(const flight_key& o) const
+                {
+                    return a == o.a && b == o.b && key == o.key;
+                }
+            };
+
+            struct flight_key_hash
+            {
+                std::size_t operator()(const flight_key& k) const;
+            };
+
+            struct pending
+            {
+                shared_diff_future result;
+                std::weak_ptr<void> interest;
+            };
+
+            using flights = std::unordered_map<flight_key, pending, flight_key_hash>;
+
+            struct shard
+            {
+                std::mutex mutex;
+                flights in_flight;
+                std::size_t sweep_size = 0;
+            };
+
+            using shard_ptr = std::unique_ptr<shard>;
+            using shards = std::vector<shard_ptr>;
+
+        private:
+            void sweep(shard& s);
+
+        private:
+            server& _db;
+            shards _shards;
+    };
+}
+#endif
@@ -1,16 +1,51 @@
 #include "service/threaded.hpp"
 
+#include "util/glob.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+
 namespace henhouse::threaded
 {
     const std::size_t QUEUE_SIZE = 1000;
 
+    //keys scanned by a top request before letting other requests through
+    const std::size_t TOP_BATCH = 256;
+
+    //keys a glob may examine since it is matched on the caller's thread, about 10ms
+    const std::size_t MAX_KEYS_EXAMINED = 100000;
+
+    //how long workers and openers wait for a request before checking if the server stopped
+    const std::chrono::milliseconds STOP_WAIT{100};
+
+    //how long an opener waits before sending opened timelines to full worker queues again
+    const std::chrono::milliseconds OPEN_RETRY_WAIT{1};
+
     worker::worker(
             const std::string & root, 
             const std::size_t queue_size, 
             const std::size_t cache_size,
+            const std::size_t result_cache_size,
             const db::time_type new_timeline_resolution,
+            const db::feature_rules& features,
+            const db::rollup_resolutions& rollups,
+            const db::retention_rules& retention,
+            const db::ring_rules& rings,
+            const std::size_t mapped_budget,
+            db::key_catalog& catalog,
+            db::tag_index& tags,
+            const std::size_t hot_keys_size,
+            const std::time_t hot_window,
+            open_queue* opens,
             bool* done) : 
-        _db{root, cache_size, new_timeline_resolution}, _queue{queue_size}, _done{done}
+        _queue{queue_size}, 
+        _opens{opens},
+        _done{done},
+        _catalog{catalog},
+        _tags{tags},
+        _db{root, cache_size, result_cache_size, new_timeline_resolution, features, rollups, retention, rings, mapped_budget, catalog},
+        _hot{hot_keys_size, hot_window}
     {
         REQUIRE(done);
         REQUIRE_GREATER(queue_size, 0);
@@ -18,6 +53,72 @@ namespace henhouse::threaded
         REQUIRE_GREATER(new_timeline_resolution, 0);
     }
 
+    namespace
+    {
+        //key of the timeline a request uses, or nullptr if it doesn't use one
+        struct req_key : public boost::static_visitor<const std::string*>
+        {
+            const std::string* operator()(const put_req& r) const { return &r.key;}
+            const std::string* operator()(const get_req& r) const { return &r.key;}
+            const std::string* operator()(const diff_req& r) const { return &r.key;}
+            const std::string* operator()(const summary_req& r) const { return &r.key;}
+            const std::string* operator()(const version_req& r) const { return &r.key;}
+
+            template <class other>
+                const std::string* operator()(const other&) const { return nullptr;}
+        };
+    }
+
+    bool worker::park(req& r)
+    {
+        if(!_opens) return false;
+
+        const auto key = boost::apply_visitor(req_key{}, r);
+        if(!key) return false;
+
+        auto p = _parked.find(*key);
+        if(p != std::end(_parked)) 
+        {
+            p->second.push_back(std::move(r));
+            return true;
+        }
+
+        if(_db.cached(*key)) return false;
+
+        //queries on unknown keys are answered without opening anything
+        if(!boost::get<put_req>(&r) && !_db.known(*key)) return false;
+
+        //open inline when the openers are backed up
+        if(!_opens->write(open_req{this, *key})) return false;
+
+        _parked[*key].push_back(std::move(r));
+        return true;
+    }
+
+    std::vector<req> worker::unpark(const std::string& key)
+    {
+        std::vector<req> parked;
+
+        auto p = _parked.find(key);
+        if(p == std::end(_parked)) return parked;
+
+        parked = std::move(p->second);
+        _parked.erase(p);
+        return parked;
+    }
+
+    namespace
+    {
+        //nobody should be waiting on a cancelled request, but anyone who is gets an error
+        template <class promise>
+            void cancel(promise& p)
+            {
+                p.set_exception(std::make_exception_ptr(cancelled_error{}));
+            }
+    }
+
+    //Cancelled requests are skipped and their result set to a cancelled_error
+    //so a waiter never sees a broken promise.
     struct req_processeor
     {
         worker* w;
@@ -27,7 +128,15 @@ namespace henhouse::threaded
         {
             INVARIANT(w);
             REQUIRE_GREATER(r.key.size(), 0);
-            w->db().put(r.key.data(), r.time, r.count);
+            const bool added = r.observation ? 
+                w->db().observe(r.key.data(), r.time, r.count) :
+                w->db().put(r.key.data(), r.time, r.count);
+
+            //puts outside the late write window are dropped so they aren't hot or indexed
+            if(!added) return;
+
+            w->hot().add(r.key, r.count, std::time(nullptr));
+            if(!r.tagged.empty()) w->tags().add(r.tagged);
         }
         catch(std::exception& e) 
         {
@@ -40,6 +149,8 @@ namespace henhouse::threaded
         {
             INVARIANT(w);
             REQUIRE_GREATER(r.key.size(), 0);
+            if(r.token.cancelled()) return cancel(r.result);
+
             r.result.set_value(w->db().get(r.key, r.time));
         }
         catch(std::exception& e) 
@@ -54,6 +165,8 @@ namespace henhouse::threaded
         {
             INVARIANT(w);
             REQUIRE_GREATER(r.key.size(), 0);
+            if(r.token.cancelled()) return cancel(r.result);
+
             r.result.set_value(w->db().diff(r.key, r.a, r.b, r.index_offset));
         }
         catch(std::exception& e) 
@@ -68,6 +181,8 @@ namespace henhouse::threaded
         {
             INVARIANT(w);
             REQUIRE_GREATER(r.key.size(), 0);
+            if(r.token.cancelled()) return cancel(r.result);
+
             r.result.set_value(w->db().summary(r.key));
         }
         catch(std::exception& e) 
@@ -76,6 +191,173 @@ namespace henhouse::threaded
                 << ": " << e.what() << std::endl;
             r.result.set_value(db::summary_result{});
         }
+
+        //failure is passed on since any default version could falsely match
+        void operator()(version_req& r)
+        try
+        {
+            INVARIANT(w);
+            REQUIRE_GREATER(r.key.size(), 0);
+            if(r.token.cancelled()) return cancel(r.result);
+
+            r.result.set_value(w->db().version(r.key, r.time));
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error versioning data: " << r.key
+                << " " << r.time << ": " << e.what() << std::endl;
+            r.result.set_exception(std::current_exception());
+        }
+
+        void operator()(pair_put_req& r)
+        try
+        {
+            INVARIANT(w);
+            w->db().put_pair(r.pair, r.side, r.time, r.count);
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error putting pair data: " << db::pair_id(r.pair) 
+                << " " << r.count << ": " << e.what() << std::endl;
+        }
+
+        void operator()(corr_req& r)
+        try
+        {
+            INVARIANT(w);
+            if(r.token.cancelled()) return cancel(r.result);
+
+            r.result.set_value(w->db().corr(r.pair, r.a, r.b));
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error correlating data: " << db::pair_id(r.pair)
+                << " (" << r.a << ", " << r.b << "): " << e.what() << std::endl;
+            r.result.set_value(db::corr_result{});
+        }
+
+        /**
+         * Scans a batch of keys and puts the request back on the queue to continue
+         * later so puts and queries are not stuck behind a long scan. If the queue 
+         * is full the scan just continues.
+         *
+         * Keys an opener is opening are deferred to the end of the scan, by when 
+         * their timeline is usually cached. Keys still being opened then put the 
+         * request back on the queue to wait, or are left out if the queue is full.
+         */
+        void operator()(top_req& r)
+        try
+        {
+            INVARIANT(w);
+
+            auto& s = r.scan;
+            const auto score = [&](const std::string& k)
+            {
+                const auto d = w->db().peek_diff(k, s.a, s.b);
+                db::push_top(s.heap, s.n, db::top_item{k, d, db::top_score(d, s.by)});
+            };
+
+            while(true)
+            {
+                if(r.token.cancelled()) return cancel(r.result);
+
+                const auto keys = w->catalog().scan(s.prefix, s.cursor, s.started, TOP_BATCH);
+                for(const auto& k : keys)
+                {
+                    s.cursor = k;
+                    s.started = true;
+
+                    if(worker_for(k, r.workers) != r.worker) continue;
+                    if(!util::glob_match(s.glob, k)) continue;
+
+                    if(w->opening(k)) r.deferred.push_back(k);
+                    else score(k);
+                }
+
+                if(keys.size() < TOP_BATCH) break;
+                if(w->queue().write(std::move(r))) return;
+            }
+
+            //a request back from waiting scans past the cursor again, which finds nothing new
+            const auto opened = std::partition(std::begin(r.deferred), std::end(r.deferred),
+                    [&](const std::string& k) { return w->opening(k);});
+
+            std::for_each(opened, std::end(r.deferred), score);
+            r.deferred.erase(opened, std::end(r.deferred));
+
+            if(!r.deferred.empty() && w->queue().write(std::move(r))) return;
+
+            db::sort_top(s.heap);
+            r.result.set_value(std::move(s.heap));
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error scanning top keys: " << r.scan.glob
+                << " (" << r.scan.a << ", " << r.scan.b << "): " << e.what() << std::endl;
+            r.result.set_exception(std::current_exception());
+        }
+
+        /**
+         * Like the top scan, truncates a batch of keys at a time and puts
+         * the request back on the queue to continue later. Keys an opener is 
+         * opening are skipped and truncated by the next run of the retention.
+         */
+        void operator()(retain_req& r)
+        try
+        {
+            INVARIANT(w);
+
+            while(true)
+            {
+                const auto keys = w->catalog().scan("", r.cursor, r.started, TOP_BATCH);
+                for(const auto& k : keys)
+                {
+                    r.cursor = k;
+                    r.started = true;
+
+                    if(worker_for(k, r.workers) != r.worker) continue;
+                    if(w->opening(k)) continue;
+
+                    w->db().retain(k, r.now);
+                }
+
+                if(keys.size() < TOP_BATCH) break;
+                if(w->queue().write(std::move(r))) return;
+            }
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error truncating timelines after: " << r.cursor 
+                << " (" << r.now << "): " << e.what() << std::endl;
+        }
+
+        //requests of a failed open are processed anyway and open the timeline themselves
+        void operator()(opened_req& r)
+        try
+        {
+            INVARIANT(w);
+
+            if(r.opened) w->db().adopt(r.key, std::move(r.timeline));
+            for(auto& p : w->unpark(r.key)) boost::apply_visitor(*this, p);
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error resuming requests on: " << r.key << ": " << e.what() << std::endl;
+        }
+
+        void operator()(hot_req& r)
+        try
+        {
+            INVARIANT(w);
+            if(r.token.cancelled()) return cancel(r.result);
+
+            r.result.set_value(w->hot().top(r.by, r.recent, r.n, std::time(nullptr)));
+        }
+        catch(std::exception& e) 
+        {
+            std::cerr << "Error getting hot keys: " << e.what() << std::endl;
+            r.result.set_value(hitters{});
+        }
     };
 
     void req_thread(worker* w) 
@@ -90,7 +372,9 @@ namespace henhouse::threaded
         try
         {
             req r;
-            q.blockingRead(r);
+            if(!q.tryReadUntil(std::chrono::steady_clock::now() + STOP_WAIT, r)) continue;
+            if(w->park(r)) continue;
+
             boost::apply_visitor(processeor, r);
         }
         catch (const std::exception& e)
@@ -99,12 +383,77 @@ namespace henhouse::threaded
         }
     }
 
+    /**
+     * Opens timelines for the workers and sends them back on the worker queue.
+     * Only the thread safe open of the worker db is used. The index is read ahead
+     * since every request on the timeline searches it.
+     *
+     * Reads wait a little at a time so the thread sees the server stop. Opened
+     * timelines whose worker queue is full are kept and sent again between reads
+     * instead of blocking, so one busy worker doesn't stall the openers.
+     */
+    void open_thread(open_queue* q, const bool* done)
+    {
+        REQUIRE(q);
+        REQUIRE(done);
+
+        std::deque<std::pair<worker*, opened_req>> unsent;
+
+        while(!*done)
+        try
+        {
+            for(auto u = std::begin(unsent); u != std::end(unsent);)
+            {
+                if(u->first->queue().write(std::move(u->second))) u = unsent.erase(u);
+                else u++;
+            }
+
+            //retry sooner while something is waiting to be sent
+            const auto wait = unsent.empty() ? STOP_WAIT : OPEN_RETRY_WAIT;
+
+            open_req r;
+            if(!q->tryReadUntil(std::chrono::steady_clock::now() + wait, r)) continue;
+            CHECK(r.w);
+
+            opened_req o;
+            o.key = r.key;
+            try
+            {
+                o.timeline = r.w->db().open(r.key);
+                o.timeline.index.will_need();
+                o.opened = true;
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "error opening timeline: " << r.key << ": " << e.what() << std::endl;
+            }
+
+            if(!r.w->queue().write(std::move(o))) unsent.emplace_back(r.w, std::move(o));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "error processing open: " << e.what() << std::endl;
+        }
+    }
+
     server::server(
             const std::size_t total_workers, 
             const std::string& root, 
             const std::size_t queue_size,
             const std::size_t cache_size,
-            const db::time_type new_timeline_resolution) : _root{root}, _done{false} 
+            const std::size_t result_cache_size,
+            const db::time_type new_timeline_resolution,
+            const db::feature_rules& features,
+            const db::rollup_resolutions& rollups,
+            const db::retention_rules& retention,
+            const std::time_t retention_interval,
+            const db::ring_rules& rings,
+            const std::size_t mapped_budget,
+            const std::size_t openers,
+            const db::key_pairs& pairs,
+            const std::size_t hot_keys_size,
+            const std::time_t hot_window) : 
+        _root{root}, _catalog{root}, _tags{root}, _opens{std::max<std::size_t>(queue_size, 1)}, _done{false}, _pairs{pairs}, _hot_window{hot_window}
     {
         REQUIRE_GREATER(total_workers, 0);
         REQUIRE_GREATER(queue_size, 0);
@@ -115,12 +464,41 @@ namespace henhouse::threaded
 
         while(--workers)
         {
-            auto w = std::make_unique<worker>(_root, queue_size, cache_size, new_timeline_resolution, &_done);
+            auto w = std::make_unique<worker>(
+                    _root, 
+                    queue_size, 
+                    cache_size, 
+                    result_cache_size, 
+                    new_timeline_resolution, 
+                    features,
+                    rollups,
+                    retention,
+                    rings,
+                    mapped_budget,
+                    _catalog,
+                    _tags,
+                    hot_keys_size,
+                    hot_window,
+                    openers > 0 ? &_opens : nullptr,
+                    &_done);
             auto t = std::make_unique<std::thread>(req_thread, w.get());
 
             _workers.emplace_back(std::move(w));
             _threads.emplace_back(std::move(t));
         }
+
+        for(std::size_t p = 0; p < _pairs.size(); p++)
+        {
+            _pair_sides[_pairs[p].x].push_back(pair_side_ref{p, db::pair_side::x});
+            _pair_sides[_pairs[p].y].push_back(pair_side_ref{p, db::pair_side::y});
+        }
+
+        for(std::size_t o = 0; o < openers; o++)
+            _threads.emplace_back(std::make_unique<std::thread>(open_thread, &_opens, &_done));
+
+        //joined with the workers on stop
+        if(!retention.empty())
+            _threads.emplace_back(std::make_unique<std::thread>(&server::retain_every, this, retention_interval));
     }
 
     server::~server()
@@ -144,25 +522,87 @@ namespace henhouse::threaded
         db::sanatize_key(safe_key, key);
 
         auto n = worker_num(safe_key);
+        put_pairs(safe_key, t, c);
+
+        put_req r {std::move(safe_key), t, c, false, db::is_tagged(key) ? key.to_string() : std::string{}};
+        _workers[n]->queue().write(std::move(r));
+    }
+
+    void server::observe(const stde::string_view& key, db::time_type t, db::count_type v)
+    {
+        std::string safe_key;
+        safe_key.reserve(key.size());
+        db::sanatize_key(safe_key, key);
+
+        auto n = worker_num(safe_key);
+        put_pairs(safe_key, t, v);
+
+        put_req r {std::move(safe_key), t, v, true, db::is_tagged(key) ? key.to_string() : std::string{}};
+        _workers[n]->queue().write(std::move(r));
+    }
+
+    //pair timelines are owned by the worker of the pair id
+    void server::put_pairs(const std::string& key, db::time_type t, db::count_type c)
+    {
+        if(_pair_sides.empty()) return;
+
+        const auto sides = _pair_sides.find(key);
+        if(sides == std::end(_pair_sides)) return;
+
+        for(const auto& s : sides->second)
+        {
+            const auto& p = _pairs[s.pair];
+            auto n = worker_num(db::pair_id(p));
 
-        put_req r {std::move(safe_key), t, c};
+            pair_put_req r{p, s.side, t, c};
+            _workers[n]->queue().write(std::move(r));
+        }
+    }
+
+    corr_future server::corr(
+            const stde::string_view& x, 
+            const stde::string_view& y, 
+            db::time_type a, 
+            db::time_type b, 
+            const cancel_token& token) const
+    {
+        db::key_pair p;
+        db::sanatize_key(p.x, x);
+        db::sanatize_key(p.y, y);
+
+        auto n = worker_num(db::pair_id(p));
+
+        corr_req r{std::move(p), a, b, token};
+        corr_future f = r.result.get_future();
         _workers[n]->queue().write(std::move(r));
+        return f;
     }
 
-    summary_future server::summary(const stde::string_view& key) const 
+    bool server::has_pair(const stde::string_view& x, const stde::string_view& y) const
+    {
+        std::string safe_x;
+        std::string safe_y;
+        db::sanatize_key(safe_x, x);
+        db::sanatize_key(safe_y, y);
+
+        return std::any_of(std::begin(_pairs), std::end(_pairs), 
+                [&](const auto& p) { return p.x == safe_x && p.y == safe_y;});
+    }
+
+    summary_future server::summary(const stde::string_view& key, const cancel_token& token) const 
     {
         std::string safe_key;
         safe_key.reserve(key.size());
         db::sanatize_key(safe_key, key);
 
         auto n = worker_num(safe_key);
-        summary_req r{std::move(safe_key)};
+        summary_req r{std::move(safe_key), token};
         summary_future f = r.result.get_future();
         _workers[n]->queue().write(std::move(r));
         return f;
     }
 
-    get_future server::get(const stde::string_view& key, db::time_type t) const 
+    get_future server::get(const stde::string_view& key, db::time_type t, const cancel_token& token) const 
     {
         std::string safe_key;
         safe_key.reserve(key.size());
@@ -170,13 +610,18 @@ namespace henhouse::threaded
 
         auto n = worker_num(safe_key);
 
-        get_req r{std::move(safe_key), t};
+        get_req r{std::move(safe_key), t, token};
         get_future f = r.result.get_future();
         _workers[n]->queue().write(std::move(r));
         return f;
     }
 
-    diff_future server::diff(const stde::string_view& key, db::time_type a, db::time_type b, const db::offset_type index_offset) const
+    diff_future server::diff(
+            const stde::string_view& key, 
+            db::time_type a, 
+            db::time_type b, 
+            const db::offset_type index_offset,
+            const cancel_token& token) const
     {
         std::string safe_key;
         safe_key.reserve(key.size());
@@ -184,18 +629,166 @@ namespace henhouse::threaded
 
         auto n = worker_num(safe_key);
 
-        diff_req r{std::move(safe_key), a, b, index_offset};
+        diff_req r{std::move(safe_key), a, b, index_offset, token};
         diff_future f = r.result.get_future();
         _workers[n]->queue().write(std::move(r));
         return f;
     }
 
-    std::size_t server::worker_num(const stde::string_view& key) const
+    version_future server::version(const stde::string_view& key, db::time_type t, const cancel_token& token) const 
     {
+        std::string safe_key;
+        safe_key.reserve(key.size());
+        db::sanatize_key(safe_key, key);
+
+        auto n = worker_num(safe_key);
+
+        version_req r{std::move(safe_key), t, token};
+        version_future f = r.result.get_future();
+        _workers[n]->queue().write(std::move(r));
+        return f;
+    }
+
+    top_futures server::top(
+            const stde::string_view& glob, 
+            db::time_type a, 
+            db::time_type b, 
+            std::size_t n, 
+            db::top_stat by, 
+            const cancel_token& token) const
+    {
+        REQUIRE_GREATER(n, 0);
+
+        db::top_scan s;
+        db::sanatize_glob(s.glob, glob);
+        s.prefix = s.glob.substr(0, s.glob.find_first_of("*?"));
+        s.a = a;
+        s.b = b;
+        s.n = n;
+        s.by = by;
+
+        top_futures fs;
+        for(std::size_t w = 0; w < _workers.size(); w++)
+        {
+            top_req r{s, w, _workers.size(), token};
+            fs.emplace_back(r.result.get_future());
+            _workers[w]->queue().write(std::move(r));
+        }
+        return fs;
+    }
+
+    db::key_list server::keys(const stde::string_view& glob, std::size_t max) const
+    {
+        REQUIRE_GREATER(max, 0);
+
+        std::string safe_glob;
+        db::sanatize_glob(safe_glob, glob);
+        const auto prefix = safe_glob.substr(0, safe_glob.find_first_of("*?"));
+
+        db::key_list matches;
+        std::string cursor;
+        bool started = false;
+        std::size_t examined = 0;
+        while(matches.size() < max)
+        {
+            const auto batch = _catalog.scan(prefix, cursor, started, TOP_BATCH);
+            for(const auto& k : batch)
+            {
+                if(!util::glob_match(safe_glob, k)) continue;
+                matches.push_back(k);
+                if(matches.size() == max) break;
+            }
+
+            if(batch.size() < TOP_BATCH) break;
+            cursor = batch.back();
+            started = true;
+
+            examined += batch.size();
+            if(examined >= MAX_KEYS_EXAMINED && matches.size() < max)
+                throw std::invalid_argument{
+                    "glob " + glob.to_string() + " examines more than " + 
+                        std::to_string(MAX_KEYS_EXAMINED) + " keys, give it a longer prefix"};
+        }
+
+        ENSURE_LESS_EQUAL(matches.size(), max);
+        return matches;
+    }
+
+    db::key_list server::tagged(const db::tag_exprs& exprs, std::size_t max) const
+    {
+        REQUIRE_GREATER(max, 0);
+        return _tags.find(exprs, max);
+    }
+
+    void server::retain(db::time_type now)
+    {
+        for(std::size_t w = 0; w < _workers.size(); w++)
+            _workers[w]->queue().blockingWrite(retain_req{w, _workers.size(), now});
+    }
+
+    void server::retain_every(std::time_t interval)
+    {
+        REQUIRE_GREATER(interval, 0);
+
+        auto next = std::time(nullptr);
+        while(!_done)
+        {
+            const auto now = std::time(nullptr);
+            if(now >= next)
+            {
+                retain(now);
+                next = now + interval;
+            }
+
+            std::this_thread::sleep_for(std::chrono::seconds{1});
+        }
+    }
+
+    hot_futures server::hot(
+            hot_stat by, 
+            bool recent, 
+            std::size_t n, 
+            const cancel_token& token) const
+    {
+        REQUIRE_GREATER(n, 0);
+
+        hot_futures fs;
+        for(auto& w : _workers)
+        {
+            hot_req r{by, recent, n, token};
+            fs.emplace_back(r.result.get_future());
+            w->queue().write(std::move(r));
+        }
+        return fs;
+    }
+
+    util::cache_stats server::cache_stats() const
+    {
+        util::cache_stats total;
+        for(const auto& w : _workers)
+        {
+            const auto s = w->db().cache_stats();
+            total.hits += s.hits;
+            total.misses += s.misses;
+            total.evictions += s.evictions;
+            total.size += s.size;
+        }
+        return total;
+    }
+
+    std::size_t worker_for(const stde::string_view& key, const std::size_t workers)
+    {
+        REQUIRE_GREATER(workers, 0);
+
         auto h = std::hash<stde::string_view>{}(key);
-        auto n = h % _workers.size(); //exclude rank 0
+        auto n = h % workers; 
 
-        ENSURE_RANGE(n, 0, _workers.size());
+        ENSURE_RANGE(n, 0, workers);
         return n; 
     }
+
+    std::size_t server::worker_num(const stde::string_view& key) const
+    {
+        return worker_for(key, _workers.size());
+    }
 }
@@ -6,9 +6,13 @@
 #include <thread>
 #include <future>
 #include <memory>
+#include <stdexcept>
 #include <boost/variant.hpp>
+#include <unordered_map>
 
 #include "db/db.hpp"
+#include "db/tags.hpp"
+#include "service/hot_keys.hpp"
 
 #include <folly/MPMCQueue.h>
 
@@ -16,25 +20,71 @@ namespace stde = std::experimental;
 
 namespace henhouse::threaded
 {
-    enum req_type { put, get, diff, summary};
+    enum req_type { put, get, diff, summary, version, pair_put, corr, top, hot, retain, opened};
     using get_promise = std::promise<db::get_result>;
     using get_future = std::future<db::get_result>;
     using diff_promise = std::promise<db::diff_result>;
     using diff_future = std::future<db::diff_result>;
     using summary_promise = std::promise<db::summary_result>;
     using summary_future = std::future<db::summary_result>;
+    using version_promise = std::promise<db::version_type>;
+    using version_future = std::future<db::version_type>;
+    using corr_promise = std::promise<db::corr_result>;
+    using corr_future = std::future<db::corr_result>;
+    using top_promise = std::promise<db::top_items>;
+    using top_future = std::future<db::top_items>;
+    using top_futures = std::vector<top_future>;
+    using hot_promise = std::promise<hitters>;
+    using hot_future = std::future<hitters>;
+    using hot_futures = std::vector<hot_future>;
+
+    /**
+     * Queued requests hold a weak reference to the interest of whoever is
+     * waiting on the result. Once the interest goes away, for example when
+     * an http client disconnects, the request is cancelled and the workers
+     * skip it.
+     */
+    using interest_ptr = std::shared_ptr<void>;
+
+    class cancel_token
+    {
+        public:
+            cancel_token() = default;
+            explicit cancel_token(const interest_ptr& interest) : 
+                _interest{interest}, _cancellable{true} 
+            {
+                REQUIRE(interest);
+            }
+
+            bool cancelled() const { return _cancellable && _interest.expired(); }
+
+        private:
+            std::weak_ptr<void> _interest;
+            bool _cancellable = false;
+    };
+
+    inline interest_ptr make_interest() { return std::make_shared<bool>(true); }
+
+    //the result of a request that was cancelled before a worker got to it
+    struct cancelled_error : public std::runtime_error
+    {
+        cancelled_error() : std::runtime_error{"request cancelled"} {}
+    };
 
     struct put_req
     {
         std::string key;
         db::time_type time;
         db::count_type count;
+        bool observation;   //count is an observation for the histogram
+        std::string tagged; //key as written if it has tags, indexed once the put is accepted
     };
 
     struct get_req
     {
         std::string key;
         db::time_type time;
+        cancel_token token;
         get_promise result;
     };
 
@@ -44,26 +94,123 @@ namespace henhouse::threaded
         db::time_type a;
         db::time_type b;
         db::offset_type index_offset;
+        cancel_token token;
         diff_promise result;
     };
 
     struct summary_req
     {
         std::string key;
+        cancel_token token;
         summary_promise result;
     };
 
-    using req = boost::variant<put_req, get_req, diff_req, summary_req>; 
+    struct version_req
+    {
+        std::string key;
+        db::time_type time;
+        cancel_token token;
+        version_promise result;
+    };
+
+    struct pair_put_req
+    {
+        db::key_pair pair;
+        db::pair_side side;
+        db::time_type time;
+        db::count_type count;
+    };
+
+    struct corr_req
+    {
+        db::key_pair pair;
+        db::time_type a;
+        db::time_type b;
+        cancel_token token;
+        corr_promise result;
+    };
+
+    //scans the keys owned by one worker in batches
+    struct top_req
+    {
+        db::top_scan scan;
+        std::size_t worker;
+        std::size_t workers;
+        cancel_token token;
+        top_promise result;
+        std::vector<std::string> deferred;  //keys being opened when they were scanned
+    };
+
+    //truncates the timelines owned by one worker in batches
+    struct retain_req
+    {
+        std::size_t worker;
+        std::size_t workers;
+        db::time_type now;
+        std::string cursor;         //last key scanned
+        bool started = false;
+    };
+
+    struct hot_req
+    {
+        hot_stat by;
+        bool recent;
+        std::size_t n;
+        cancel_token token;
+        hot_promise result;
+    };
+
+    //timeline opened off the worker for the requests parked on the key
+    struct opened_req
+    {
+        std::string key;
+        db::timeline timeline;
+        bool opened = false;        //false if opening failed
+    };
+
+    using req = boost::variant<
+        put_req, 
+        get_req, 
+        diff_req, 
+        summary_req, 
+        version_req, 
+        pair_put_req, 
+        corr_req, 
+        top_req,
+        hot_req,
+        retain_req,
+        opened_req>; 
 
     using req_queue= folly::MPMCQueue<req>;
 
+    class worker;
+
+    struct open_req
+    {
+        worker* w;
+        std::string key;
+    };
+
+    using open_queue = folly::MPMCQueue<open_req>;
+
     class worker  
     {
         public: 
             worker(const std::string & root, 
                     const std::size_t queue_size, 
                     const std::size_t cache_size, 
+                    const std::size_t result_cache_size, 
                     const db::time_type new_timeline_resolution,
+                    const db::feature_rules& features,
+                    const db::rollup_resolutions& rollups,
+                    const db::retention_rules& retention,
+                    const db::ring_rules& rings,
+                    const std::size_t mapped_budget,
+                    db::key_catalog& catalog,
+                    db::tag_index& tags,
+                    const std::size_t hot_keys_size,
+                    const std::time_t hot_window,
+                    open_queue* opens,
                     bool* done);
 
             req_queue& queue() { return _queue;}
@@ -72,13 +219,47 @@ namespace henhouse::threaded
             db::timeline_db& db() { return _db;}
             const db::timeline_db& db() const { return _db;}
 
+            const db::key_catalog& catalog() const { return _catalog;}
+            db::tag_index& tags() { return _tags;}
+
+            hot_keys& hot() { return _hot;}
+            const hot_keys& hot() const { return _hot;}
+
             bool done() const { INVARIANT(_done); return *_done;}
 
+            /**
+             * Parks a request on a key whose timeline is not cached and hands the 
+             * open to the openers, so the worker keeps going with other keys. 
+             * Requests on a key already being opened are parked behind it to keep 
+             * their order. Returns false if the request should be processed now.
+             */
+            bool park(req& r);
+
+            //requests parked on the key, in the order they came in
+            std::vector<req> unpark(const std::string& key);
+
+            //true while an opener has the key, which must not be opened on the worker too
+            bool opening(const std::string& key) const { return _parked.count(key) != 0;}
+
         private:
             req_queue _queue;
+            open_queue* _opens;
+            std::unordered_map<std::string, std::vector<req>> _parked;
 
             bool* _done;
+            db::key_catalog& _catalog;
+            db::tag_index& _tags;
             db::timeline_db _db;
+            hot_keys _hot;
+    };
+
+    //the worker a key belongs to
+    std::size_t worker_for(const stde::string_view& key, const std::size_t workers);
+
+    struct pair_side_ref
+    {
+        std::size_t pair;
+        db::pair_side side;
     };
 
     using worker_ptr = std::unique_ptr<worker>;
@@ -94,25 +275,114 @@ namespace henhouse::threaded
                     const std::string& root, 
                     const std::size_t queue_size, 
                     const std::size_t cache_size,
-                    const db::time_type new_timeline_resolution);
+                    const std::size_t result_cache_size,
+                    const db::time_type new_timeline_resolution,
+                    const db::feature_rules& features,
+                    const db::rollup_resolutions& rollups,
+                    const db::retention_rules& retention,
+                    const std::time_t retention_interval,
+                    const db::ring_rules& rings,
+                    const std::size_t mapped_budget,
+                    const std::size_t openers,
+                    const db::key_pairs& pairs,
+                    const std::size_t hot_keys_size,
+                    const std::time_t hot_window);
             ~server();
 
-            summary_future summary(const stde::string_view& key) const; 
-            get_future get(const stde::string_view& key, db::time_type t) const; 
+            summary_future summary(
+                    const stde::string_view& key, 
+                    const cancel_token& token = cancel_token{}) const; 
+
+            get_future get(
+                    const stde::string_view& key, 
+                    db::time_type t, 
+                    const cancel_token& token = cancel_token{}) const; 
+
             void put(const stde::string_view& key, db::time_type t, db::count_type c);
-            diff_future diff(const stde::string_view& key, db::time_type a, db::time_type b, const db::offset_type index_offset) const;
+            void observe(const stde::string_view& key, db::time_type t, db::count_type v);
+
+            diff_future diff(
+                    const stde::string_view& key, 
+                    db::time_type a, 
+                    db::time_type b, 
+                    const db::offset_type index_offset,
+                    const cancel_token& token = cancel_token{}) const;
+
+            version_future version(
+                    const stde::string_view& key, 
+                    db::time_type t, 
+                    const cancel_token& token = cancel_token{}) const; 
+
+            //correlation of a declared pair of keys
+            corr_future corr(
+                    const stde::string_view& x, 
+                    const stde::string_view& y, 
+                    db::time_type a, 
+                    db::time_type b, 
+                    const cancel_token& token = cancel_token{}) const;
+
+            bool has_pair(const stde::string_view& x, const stde::string_view& y) const;
+
+            /**
+             * Every worker scans the keys it owns matching the glob and returns its 
+             * top n. Merge the results to get the top n overall.
+             */
+            top_futures top(
+                    const stde::string_view& glob, 
+                    db::time_type a, 
+                    db::time_type b, 
+                    std::size_t n, 
+                    db::top_stat by, 
+                    const cancel_token& token = cancel_token{}) const;
+
+            /**
+             * Up to max keys matching the glob in sorted order, found through the 
+             * key catalog. Keys before the first wildcard are found with a prefix 
+             * search so globs starting with a literal prefix are cheap. The scan 
+             * runs on the calling thread, so it throws std::invalid_argument once 
+             * it examines too many keys without finding max.
+             */
+            db::key_list keys(const stde::string_view& glob, std::size_t max) const;
+
+            //up to max keys of tagged series matching all the seriesByTag expressions
+            db::key_list tagged(const db::tag_exprs& exprs, std::size_t max) const;
+
+            //heaviest keys put into each worker. Keys are owned by one worker so just concat the results.
+            hot_futures hot(
+                    hot_stat by, 
+                    bool recent, 
+                    std::size_t n, 
+                    const cancel_token& token = cancel_token{}) const;
+
+            std::time_t hot_window() const { return _hot_window;}
+
+            //timeline cache counters summed over the workers
+            util::cache_stats cache_stats() const;
+
+            //truncates all timelines with a retention rule, relative to now
+            void retain(db::time_type now);
 
             void stop();
 
         private:
 
             std::size_t worker_num(const stde::string_view& key) const;
+            void put_pairs(const std::string& key, db::time_type t, db::count_type c);
+            void retain_every(std::time_t interval);
 
         private:
             std::string _root;
+            db::key_catalog _catalog;
+            db::tag_index _tags;
+            open_queue _opens;
             workers _workers;
             threads _threads;
             bool _done;
+
+            //sides of declared pairs each key is on
+            db::key_pairs _pairs;
+            std::unordered_map<std::string, std::vector<pair_side_ref>> _pair_sides;
+            std::time_t _hot_window;
     };
 }
 #endif
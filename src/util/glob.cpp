@@ -0,0 +1,42 @@
+#include "util/glob.hpp"
+
+namespace henhouse::util
+{
+    //Greedy matching which backtracks to the last star on a mismatch.
+    //Runs in O(pattern * s) worst case without recursion.
+    bool glob_match(const stde::string_view& pattern, const stde::string_view& s)
+    {
+        std::size_t p = 0;
+        std::size_t i = 0;
+        std::size_t star = stde::string_view::npos;
+        std::size_t star_i = 0;
+
+        while(i < s.size())
+        {
+            if(p < pattern.size() && (pattern[p] == '?' || pattern[p] == s[i]))
+            {
+                p++;
+                i++;
+            }
+            else if(p < pattern.size() && pattern[p] == '*')
+            {
+                star = p++;
+                star_i = i;
+            }
+            else if(star != stde::string_view::npos)
+            {
+                p = star + 1;
+                i = ++star_i;
+            }
+            else return false;
+        }
+
+        while(p < pattern.size() && pattern[p] == '*') p++;
+        return p == pattern.size();
+    }
+
+    bool is_glob(const stde::string_view& pattern)
+    {
+        return pattern.find_first_of("*?") != stde::string_view::npos;
+    }
+}
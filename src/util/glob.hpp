@@ -0,0 +1,19 @@
+#ifndef HENHOUSE_GLOB_H
+#define HENHOUSE_GLOB_H
+
+#include <experimental/string_view>
+
+namespace stde = std::experimental;
+
+namespace henhouse::util
+{
+    /**
+     * Matches a string against a glob pattern where * matches any 
+     * sequence of characters and ? matches any one character.
+     */
+    bool glob_match(const stde::string_view& pattern, const stde::string_view& s);
+
+    //true if the pattern has any wildcards
+    bool is_glob(const stde::string_view& pattern);
+}
+#endif
@@ -0,0 +1,304 @@
+#ifndef HENHOUSE_LFU_CACHE_H
+#define HENHOUSE_LFU_CACHE_H
+
+#include "util/dbc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace henhouse::util
+{
+    struct cache_stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t size = 0;
+    };
+
+    /**
+     * Approximate access counts of keys using a count-min sketch of 4 bit counters.
+     * Counts are halved once enough accesses are recorded so old popularity fades.
+     */
+    class frequency_sketch
+    {
+        public:
+            frequency_sketch() {}
+            explicit frequency_sketch(std::size_t capacity)
+            {
+                REQUIRE_GREATER(capacity, 0);
+
+                std::size_t width = 16;
+                while(width < capacity) width <<= 1;
+
+                _counts.resize(width * ROWS, 0);
+                _mask = width - 1;
+                _sample = capacity * 10;
+            }
+
+            void add(std::size_t h)
+            {
+                INVARIANT_GREATER(_sample, 0);
+
+                bool added = false;
+                for(std::size_t r = 0; r < ROWS; r++)
+                {
+                    auto& c = _counts[slot(h, r)];
+                    if(c < MAX_COUNT) { c++; added = true;}
+                }
+
+                if(added && ++_added >= _sample) age();
+            }
+
+            std::uint8_t estimate(std::size_t h) const
+            {
+                std::uint8_t e = MAX_COUNT;
+                for(std::size_t r = 0; r < ROWS; r++) e = std::min(e, _counts[slot(h, r)]);
+                return e;
+            }
+
+        private:
+            static const std::size_t ROWS = 4;
+            static const std::uint8_t MAX_COUNT = 15;
+
+            std::size_t slot(std::size_t h, std::size_t r) const
+            {
+                //each row uses a different mix of the hash. Every bit is mixed since
+                //std::hash of an integer is the integer itself and would otherwise put
+                //keys that differ only in their high bits in the same slot of every row.
+                h += (r + 1) * 0x9e3779b97f4a7c15ULL;
+                h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+                h ^= h >> 31;
+                return r * (_mask + 1) + (h & _mask);
+            }
+
+            void age()
+            {
+                for(auto& c : _counts) c >>= 1;
+                _added /= 2;
+            }
+
+        private:
+            std::vector<std::uint8_t> _counts;
+            std::size_t _mask = 0;
+            std::size_t _sample = 0;
+            std::size_t _added = 0;
+    };
+
+    /**
+     * Cache with the W-TinyLFU policy. New entries go into a small LRU window.
+     * An entry leaving the window only enters the main cache if its key was accessed
+     * more often than the entry the main cache would evict for it, so a scan of keys
+     * used once can't push out the popular ones. The main cache is a segmented LRU
+     * where entries hit a second time are protected from eviction.
+     *
+     * Hit, miss and eviction counters can be read from other threads.
+     *
+     * This interface is NOT thread safe.
+     */
+    template<typename key_t, typename value_t, typename hash_t = std::hash<key_t>>
+        class lfu_cache
+        {
+            public:
+                explicit lfu_cache(std::size_t capacity) :
+                    _capacity{capacity},
+                    _window_capacity{std::max<std::size_t>(capacity / 100, 1)},
+                    _protected_capacity{(capacity - std::min(capacity, _window_capacity)) * 4 / 5},
+                    _sketch{capacity}
+                {
+                    REQUIRE_GREATER(capacity, 0);
+                }
+
+                lfu_cache(const lfu_cache&) = delete;
+                lfu_cache& operator=(const lfu_cache&) = delete;
+
+                //value of the key, counting the access. Nullptr if the key is not cached.
+                value_t* find(const key_t& k)
+                {
+                    const auto h = _hash(k);
+                    _sketch.add(h);
+
+                    const auto e = _entries.find(k);
+                    if(e == std::end(_entries))
+                    {
+                        _misses.fetch_add(1, std::memory_order_relaxed);
+                        return nullptr;
+                    }
+
+                    _hits.fetch_add(1, std::memory_order_relaxed);
+                    touch(e->second);
+                    return &e->second.it->value;
+                }
+
+                //counts a miss of a key that was looked up some other way, like with peek
+                void missed(const key_t& k)
+                {
+                    _sketch.add(_hash(k));
+                    _misses.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                //value of the key without counting the access. Nullptr if the key is not cached.
+                value_t* peek(const key_t& k)
+                {
+                    const auto e = _entries.find(k);
+                    return e == std::end(_entries) ? nullptr : &e->second.it->value;
+                }
+
+                //caches the value and returns it. The key should not be cached.
+                value_t& set(const key_t& k, value_t v)
+                {
+                    REQUIRE(_entries.find(k) == std::end(_entries));
+
+                    _window.push_front(node{k, std::move(v)});
+                    auto& e = _entries[k];
+                    e.list = &_window;
+                    e.it = std::begin(_window);
+
+                    auto& value = e.it->value;
+                    if(_window.size() > _window_capacity) leave_window();
+
+                    _size.store(_entries.size(), std::memory_order_relaxed);
+
+                    ENSURE_LESS_EQUAL(_entries.size(), _capacity);
+                    return value;
+                }
+
+                bool erase(const key_t& k)
+                {
+                    const auto e = _entries.find(k);
+                    if(e == std::end(_entries)) return false;
+
+                    e->second.list->erase(e->second.it);
+                    _entries.erase(e);
+                    _size.store(_entries.size(), std::memory_order_relaxed);
+                    return true;
+                }
+
+                void clear()
+                {
+                    _entries.clear();
+                    _window.clear();
+                    _probation.clear();
+                    _protected.clear();
+                    _size.store(0, std::memory_order_relaxed);
+                }
+
+                //calls f with every key and value, in no particular order
+                template <class func>
+                    void for_each(func f)
+                    {
+                        for(auto& e : _entries) f(e.first, e.second.it->value);
+                    }
+
+                std::size_t size() const { return _entries.size(); }
+                bool empty() const { return _entries.empty(); }
+
+                cache_stats stats() const
+                {
+                    return cache_stats{
+                        _hits.load(std::memory_order_relaxed),
+                        _misses.load(std::memory_order_relaxed),
+                        _evictions.load(std::memory_order_relaxed),
+                        _size.load(std::memory_order_relaxed)};
+                }
+
+            private:
+                struct node
+                {
+                    key_t key;
+                    value_t value;
+                };
+
+                using node_list = std::list<node>;
+
+                struct entry
+                {
+                    node_list* list;
+                    typename node_list::iterator it;
+                };
+
+                void move_front(entry& e, node_list& to)
+                {
+                    to.splice(std::begin(to), *e.list, e.it);
+                    e.list = &to;
+                }
+
+                void touch(entry& e)
+                {
+                    if(e.list != &_probation)
+                    {
+                        move_front(e, *e.list);
+                        return;
+                    }
+
+                    //hit a second time so it is protected, making room by demoting the oldest
+                    move_front(e, _protected);
+                    if(_protected.size() > _protected_capacity && _protected.size() > 1)
+                        move_front(_entries.at(_protected.back().key), _probation);
+                }
+
+                //the oldest window entry moves to the main cache if it is more popular
+                //than the entry that would be evicted for it
+                void leave_window()
+                {
+                    CHECK_FALSE(_window.empty());
+
+                    auto& candidate = _entries.at(_window.back().key);
+                    const auto main_size = _probation.size() + _protected.size();
+                    const auto main_capacity = _capacity - std::min(_capacity, _window_capacity);
+
+                    if(main_size < main_capacity)
+                    {
+                        move_front(candidate, _probation);
+                        return;
+                    }
+
+                    auto& victims = _probation.empty() ? _protected : _probation;
+                    if(victims.empty())
+                    {
+                        evict(candidate);
+                        return;
+                    }
+
+                    auto& victim = _entries.at(victims.back().key);
+                    if(_sketch.estimate(_hash(candidate.it->key)) > _sketch.estimate(_hash(victim.it->key)))
+                    {
+                        evict(victim);
+                        move_front(candidate, _probation);
+                    }
+                    else evict(candidate);
+                }
+
+                void evict(entry& e)
+                {
+                    const auto k = e.it->key;
+                    e.list->erase(e.it);
+                    _entries.erase(k);
+                    _evictions.fetch_add(1, std::memory_order_relaxed);
+                }
+
+            private:
+                std::size_t _capacity;
+                std::size_t _window_capacity;
+                std::size_t _protected_capacity;
+                hash_t _hash;
+                frequency_sketch _sketch;
+
+                node_list _window;
+                node_list _probation;
+                node_list _protected;
+                std::unordered_map<key_t, entry, hash_t> _entries;
+
+                std::atomic<std::uint64_t> _hits{0};
+                std::atomic<std::uint64_t> _misses{0};
+                std::atomic<std::uint64_t> _evictions{0};
+                std::atomic<std::uint64_t> _size{0};
+        };
+}
+#endif
@@ -4,6 +4,7 @@
 #include "util/dbc.hpp"
 #include "util/mmap.hpp"
 
+#include <algorithm>
 #include <memory>
 
 namespace henhouse::util
@@ -20,16 +21,12 @@ namespace henhouse::util
                 {
                     REQUIRE_GREATER(new_size, 0);
 
-                    _new_size = std::max(new_size, sizeof(meta_t) + sizeof(data_type));
+                    _new_size = std::max(new_size, ITEMS_OFFSET + sizeof(data_type));
                     _data_file_path = data_file;
                     _new_size_factor = new_size_factor;
 
                     //open index data. New file size is new_size
-                    _data_file = std::make_unique<bio::mapped_file>();
-                    const bool created = open(*_data_file, data_file, new_size);
-
-                    _metadata = reinterpret_cast<meta_t*>(_data_file->data());
-                    _items = reinterpret_cast<data_type*>(_data_file->data() + sizeof(meta_t));
+                    const bool created = map_file(new_size);
 
                     if(created) 
                     {
@@ -37,10 +34,6 @@ namespace henhouse::util
                         _metadata->size = 0;
                     }
 
-                    //compute max elements
-                    _max_items = (_data_file->size() - sizeof(meta_t)) / sizeof(data_type);
-                    CHECK_LESS_EQUAL(_metadata->size, _max_items);
-
                     ENSURE(_data_file);
                     ENSURE(_metadata != nullptr);
                     ENSURE(_items != nullptr);
@@ -170,7 +163,74 @@ namespace henhouse::util
                     return *(_items + (_metadata->size - 1));
                 }
 
+                /**
+                 * Releases the disk space of whole pages holding only items before pos.
+                 * Those items read as zero afterwards. The metadata and positions of 
+                 * items don't change.
+                 */
+                void release_front(size_t pos)
+                {
+                    INVARIANT(_data_file);
+                    REQUIRE_LESS_EQUAL(pos, size());
+
+                    //never release the page with the metadata
+                    const auto first = std::max(sizeof(meta_t), PAGE_SIZE);
+                    const auto last = ITEMS_OFFSET + pos * sizeof(data_type);
+                    if(first >= last) return;
+
+                    punch_hole(_data_file_path, first, last - first);
+                }
+
+                //drops the pages of the file from memory. They are read back when touched.
+                void release_pages()
+                {
+                    INVARIANT(_data_file);
+                    _data_file->release_pages();
+                }
+
+                //reads the pages of the file ahead of them being touched
+                void will_need()
+                {
+                    INVARIANT(_data_file);
+                    _data_file->will_need();
+                }
+
+                /**
+                 * Unmaps the file so it no longer counts as mapped. Items can't be
+                 * accessed until the file is mapped again with map.
+                 */
+                void unmap()
+                {
+                    _data_file.reset();
+                    _metadata = nullptr;
+                    _items = nullptr;
+                }
+
+                //maps the file again after unmap
+                void map()
+                {
+                    if(_data_file || _data_file_path.empty()) return;
+                    map_file(_new_size);
+                }
+
+                bool mapped() const { return _data_file != nullptr; }
+
             private:
+                bool map_file(size_t new_size)
+                {
+                    _data_file = std::make_unique<mapped_file>();
+                    const bool created = open(*_data_file, _data_file_path, new_size);
+
+                    _metadata = reinterpret_cast<meta_t*>(_data_file->data());
+                    _items = reinterpret_cast<data_type*>(_data_file->data() + ITEMS_OFFSET);
+
+                    //compute max elements
+                    _max_items = (_data_file->size() - ITEMS_OFFSET) / sizeof(data_type);
+                    CHECK(created || _metadata->size <= _max_items);
+
+                    return created;
+                }
+
 
                 void resize(size_t new_size) 
                 {
@@ -181,14 +241,19 @@ namespace henhouse::util
 
                     _data_file->resize(new_size);
                     _metadata = reinterpret_cast<meta_t*>(_data_file->data());
-                    _items = reinterpret_cast<data_type*>(_data_file->data() + sizeof(meta_t));
-                    CHECK_GREATER(_data_file->size(), sizeof(meta_t));
-                    _max_items = (_data_file->size() - sizeof(meta_t)) / sizeof(data_type);
+                    _items = reinterpret_cast<data_type*>(_data_file->data() + ITEMS_OFFSET);
+                    CHECK_GREATER(_data_file->size(), ITEMS_OFFSET);
+                    _max_items = (_data_file->size() - ITEMS_OFFSET) / sizeof(data_type);
 
                     ENSURE_GREATER(_max_items, old_max);
                     ENSURE_GREATER_EQUAL(_max_items, _metadata->size);
                 }
 
+            private:
+                //items start after the metadata, aligned for types like 128 bit sums
+                static constexpr std::size_t ITEMS_OFFSET = 
+                    (sizeof(meta_t) + alignof(data_type) - 1) / alignof(data_type) * alignof(data_type);
+
             protected:
                 meta_t* _metadata = nullptr;
                 data_type* _items = nullptr;
@@ -1,33 +1,135 @@
 #include "util/mmap.hpp" 
 
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace fs = boost::filesystem;
 
 namespace henhouse::util
 {
-    bool open(bio::mapped_file& file, fs::path path, std::size_t new_size)
+    namespace
     {
-        REQUIRE_GREATER(new_size, 0);
-
-        bool created = false;
+        std::atomic<std::size_t> mapped{0};
 
-        if(fs::exists(path)) 
+        void fail(const std::string& what, const fs::path& path, int error)
         {
-            file.open(path);
+            throw std::runtime_error{what + " " + path.string() + ": " + std::strerror(error)};
         }
-        else 
+
+        //closes the descriptor when it goes out of scope
+        struct fd_guard
         {
-            bio::mapped_file_params p;
-            p.path = path.string();
-            p.new_file_size = std::max(new_size, PAGE_SIZE);
-            p.flags = bio::mapped_file::readwrite;
+            int fd;
+            ~fd_guard() { if(fd >= 0) ::close(fd); }
+        };
+    }
 
-            file.open(p);
+    mapped_file::~mapped_file()
+    {
+        if(!_data) return;
+
+        ::munmap(_data, _size);
+        mapped -= _size;
+    }
+
+    bool mapped_file::open(const fs::path& path, std::size_t new_size)
+    {
+        REQUIRE(!is_open());
+        REQUIRE_GREATER(new_size, 0);
+
+        fd_guard f{::open(path.string().c_str(), O_RDWR | O_CREAT, 0644)};
+        if(f.fd < 0) fail("unable to open", path, errno);
+
+        struct stat st;
+        if(::fstat(f.fd, &st) != 0) fail("unable to stat", path, errno);
+
+        bool created = false;
+        std::size_t size = st.st_size;
+        if(size == 0)
+        {
+            size = std::max(new_size, PAGE_SIZE);
+            if(::ftruncate(f.fd, size) != 0) fail("unable to size", path, errno);
             created = true;
         }
 
-        if(!file.is_open())
-            throw std::runtime_error{"unable to mmap " + path.string()};
+        auto d = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f.fd, 0);
+        if(d == MAP_FAILED) fail("unable to mmap", path, errno);
+
+        _data = static_cast<char*>(d);
+        _size = size;
+        _path = path;
+        mapped += _size;
 
+        ENSURE(is_open());
         return created;
     }
+
+    void mapped_file::resize(std::size_t new_size)
+    {
+        REQUIRE(is_open());
+        REQUIRE_GREATER_EQUAL(new_size, _size);
+
+        fd_guard f{::open(_path.string().c_str(), O_RDWR)};
+        if(f.fd < 0) fail("unable to open", _path, errno);
+        if(::ftruncate(f.fd, new_size) != 0) fail("unable to grow", _path, errno);
+
+        auto d = ::mremap(_data, _size, new_size, MREMAP_MAYMOVE);
+        if(d == MAP_FAILED) fail("unable to remap", _path, errno);
+
+        mapped += new_size - _size;
+        _data = static_cast<char*>(d);
+        _size = new_size;
+
+        ENSURE(is_open());
+    }
+
+    void mapped_file::release_pages()
+    {
+        REQUIRE(is_open());
+
+        //shared pages that are dirty stay in the page cache and are still written back
+        if(::madvise(_data, _size, MADV_DONTNEED) != 0) fail("unable to release pages of", _path, errno);
+    }
+
+    void mapped_file::will_need()
+    {
+        REQUIRE(is_open());
+
+        //only advice so failing is harmless
+        ::madvise(_data, _size, MADV_WILLNEED);
+    }
+
+    std::size_t mapped_bytes()
+    {
+        return mapped;
+    }
+
+    bool open(mapped_file& file, fs::path path, std::size_t new_size)
+    {
+        REQUIRE_GREATER(new_size, 0);
+        return file.open(path, new_size);
+    }
+
+    void punch_hole(const fs::path& path, std::size_t offset, std::size_t size)
+    {
+        const auto first = ((offset + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+        const auto last = ((offset + size) / PAGE_SIZE) * PAGE_SIZE;
+        if(first >= last) return;
+
+        const int fd = ::open(path.string().c_str(), O_RDWR);
+        if(fd < 0) 
+            throw std::runtime_error{"unable to open " + path.string() + ": " + std::strerror(errno)};
+
+        const int r = ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, first, last - first);
+        const int error = errno;
+        ::close(fd);
+
+        if(r != 0) 
+            throw std::runtime_error{"unable to release pages of " + path.string() + ": " + std::strerror(error)};
+    }
 }
@@ -3,17 +3,69 @@
 
 #include "util/dbc.hpp"
 
-#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/filesystem.hpp>
+#include <memory>
+#include <unistd.h>
 
-namespace bio = boost::iostreams;
 namespace henhouse::util
 {
-    using mapped_file_ptr = std::unique_ptr<bio::mapped_file>;
+    /**
+     * A read write shared mapping of a whole file. The file descriptor is closed 
+     * once the file is mapped since the mapping stays valid without it. It is only 
+     * opened again to grow the file, so open mappings don't use file descriptors.
+     */
+    class mapped_file
+    {
+        public:
+            mapped_file() {}
+            ~mapped_file();
 
-    const std::size_t PAGE_SIZE = bio::mapped_file::alignment();
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            /**
+             * Maps the file at path. A missing or empty file is created with 
+             * new_size bytes. Returns true if the file was created.
+             */
+            bool open(const boost::filesystem::path& path, std::size_t new_size);
+
+            //grows the file to new_size bytes and remaps it. data() may move.
+            void resize(std::size_t new_size);
+
+            /**
+             * Drops the pages from the mapping. The file stays mapped and pages 
+             * are read back from the page cache or disk when touched again.
+             */
+            void release_pages();
+
+            //asks the kernel to read the pages ahead of them being touched
+            void will_need();
+
+            bool is_open() const { return _data != nullptr; }
+            char* data() const { return _data; }
+            std::size_t size() const { return _size; }
+
+        private:
+            char* _data = nullptr;
+            std::size_t _size = 0;
+            boost::filesystem::path _path;
+    };
+
+    using mapped_file_ptr = std::unique_ptr<mapped_file>;
+
+    const std::size_t PAGE_SIZE = ::sysconf(_SC_PAGESIZE);
     const float GROW_FACTOR = 1.5;
 
-    bool open(bio::mapped_file& file, boost::filesystem::path path, std::size_t new_size);
+    bool open(mapped_file& file, boost::filesystem::path path, std::size_t new_size);
+
+    //bytes mapped by all mapped files in the process
+    std::size_t mapped_bytes();
+
+    /**
+     * Releases the disk space and page cache of the pages of the file within 
+     * offset and offset + size. The file size stays the same and the released
+     * pages read as zero. Only whole pages are released.
+     */
+    void punch_hole(const boost::filesystem::path& path, std::size_t offset, std::size_t size);
 }
 #endif
@@ -0,0 +1,275 @@
+#ifndef HENHOUSE_SVECTOR_H
+#define HENHOUSE_SVECTOR_H
+
+#include "util/dbc.hpp"
+#include "util/mmap.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace henhouse::util
+{
+    /**
+     * A memory mapped vector split into segment files. The first file has the
+     * metadata and as many items as fit in it. The rest of the items are in
+     * segments of the same size, stored in files named after the first file with
+     * the number of the segment appended.
+     *
+     * Growing maps one new segment and never remaps the existing ones. Segments are
+     * only mapped once they are accessed so cold segments don't use the page cache.
+     * Released segments are unlinked and their items read as zero. Since they are
+     * always the first segments only the number released is kept, so accesses
+     * never check the files.
+     */
+    template<typename meta_t, typename data_type>
+        class segmented_vector
+        {
+            public:
+                segmented_vector(){};
+                segmented_vector(
+                        const boost::filesystem::path& data_file,
+                        const size_t new_size,
+                        const size_t segment_items)
+                {
+                    REQUIRE_GREATER(new_size, 0);
+                    REQUIRE_GREATER(segment_items, 0);
+
+                    _data_file_path = data_file;
+
+                    const bool created = map_file(std::max(new_size, ITEMS_OFFSET + sizeof(data_type)));
+
+                    if(created)
+                    {
+                        *_metadata = meta_t{};
+                        _metadata->size = 0;
+                    }
+
+                    //the first file never grows so it keeps the size it was created with
+                    _first_items = (_data_file->size() - ITEMS_OFFSET) / sizeof(data_type);
+                    //segment files are at least a page
+                    _segment_items = std::max(segment_items, PAGE_SIZE / sizeof(data_type));
+
+                    //segments keep the size they were created with. The last one is never released.
+                    if(_metadata->size > _first_items)
+                    {
+                        const auto last = segment_path(segment_of(_metadata->size - 1));
+                        if(boost::filesystem::exists(last))
+                            _segment_items = boost::filesystem::file_size(last) / sizeof(data_type);
+
+                        _segments.resize(segment_of(_metadata->size - 1) + 1);
+
+                        //the last segment is never released so the search ends on a live one
+                        std::size_t live = _segments.size() - 1;
+                        while(_released < live)
+                        {
+                            const auto mid = _released + (live - _released) / 2;
+                            if(boost::filesystem::exists(segment_path(mid))) live = mid;
+                            else _released = mid + 1;
+                        }
+                    }
+
+                    ENSURE(_data_file);
+                    ENSURE(_metadata != nullptr);
+                    ENSURE(_items != nullptr);
+                    ENSURE_GREATER(_segment_items, 0);
+                }
+
+                meta_t& meta()
+                {
+                    INVARIANT(_metadata);
+                    return *_metadata;
+                }
+
+                const meta_t& meta() const
+                {
+                    INVARIANT(_metadata);
+                    return *_metadata;
+                }
+
+                std::uint64_t size() const
+                {
+                    INVARIANT(_metadata);
+                    return _metadata->size;
+                }
+
+                bool empty() const
+                {
+                    return size() == 0;
+                }
+
+                //items of released segments read as zero
+                const data_type& operator[](size_t pos) const
+                {
+                    REQUIRE_LESS(pos, size());
+
+                    static const data_type zero{};
+                    const auto item = find(pos);
+                    return item ? *item : zero;
+                }
+
+                //throws std::out_of_range for items of released segments, which can't be written
+                data_type& operator[](size_t pos)
+                {
+                    REQUIRE_LESS(pos, size());
+
+                    const auto item = find(pos);
+                    if(!item) throw std::out_of_range{"item " + std::to_string(pos) + " was released"};
+                    return *item;
+                }
+
+                void push_back(const data_type& v)
+                {
+                    INVARIANT(_metadata);
+
+                    const auto pos = _metadata->size;
+                    if(pos >= _first_items)
+                    {
+                        const auto s = segment_of(pos);
+                        if(s >= _segments.size()) _segments.resize(s + 1);
+                    }
+
+                    const auto item = find(pos);
+                    CHECK(item);
+
+                    *item = v;
+                    _metadata->size++;
+                }
+
+                data_type& back()
+                {
+                    REQUIRE_GREATER(size(), 0);
+                    return (*this)[size() - 1];
+                }
+
+                const data_type& back() const
+                {
+                    REQUIRE_GREATER(size(), 0);
+                    return (*this)[size() - 1];
+                }
+
+                /**
+                 * Releases the disk space of the items before pos. Segments holding only
+                 * items before pos are unlinked. The pages of the first file are released
+                 * except for the page with the metadata. Positions of items don't change.
+                 */
+                void release_front(size_t pos)
+                {
+                    INVARIANT(_data_file);
+                    REQUIRE_LESS_EQUAL(pos, size());
+
+                    const auto first = std::max(sizeof(meta_t), PAGE_SIZE);
+                    const auto last = ITEMS_OFFSET + std::min(pos, _first_items) * sizeof(data_type);
+                    if(first < last) punch_hole(_data_file_path, first, last - first);
+
+                    if(pos <= _first_items) return;
+
+                    const auto end = std::min(segment_of(pos), _segments.size());
+                    for(std::size_t s = _released; s < end; s++)
+                    {
+                        _segments[s].reset();
+                        boost::filesystem::remove(segment_path(s));
+                    }
+                    _released = std::max(_released, end);
+                }
+
+                /**
+                 * Drops the pages of the first file from memory and unmaps the segments.
+                 * Segments are mapped again when accessed.
+                 */
+                void release_pages()
+                {
+                    INVARIANT(_data_file);
+
+                    _data_file->release_pages();
+                    for(auto& s : _segments) s.reset();
+                }
+
+                /**
+                 * Unmaps the first file and the segments so they no longer count as 
+                 * mapped. Items can't be accessed until the first file is mapped again 
+                 * with map. Segments are mapped again when accessed.
+                 */
+                void unmap()
+                {
+                    for(auto& s : _segments) s.reset();
+                    _data_file.reset();
+                    _metadata = nullptr;
+                    _items = nullptr;
+                }
+
+                //maps the first file again after unmap
+                void map()
+                {
+                    if(_data_file || _data_file_path.empty()) return;
+                    map_file(ITEMS_OFFSET + sizeof(data_type));
+                }
+
+                bool mapped() const { return _data_file != nullptr; }
+
+            private:
+                bool map_file(size_t new_size)
+                {
+                    _data_file = std::make_unique<mapped_file>();
+                    const bool created = open(*_data_file, _data_file_path, new_size);
+
+                    _metadata = reinterpret_cast<meta_t*>(_data_file->data());
+                    _items = reinterpret_cast<data_type*>(_data_file->data() + ITEMS_OFFSET);
+                    return created;
+                }
+
+
+                std::size_t segment_of(size_t pos) const
+                {
+                    REQUIRE_GREATER_EQUAL(pos, _first_items);
+                    return (pos - _first_items) / _segment_items;
+                }
+
+                boost::filesystem::path segment_path(std::size_t s) const
+                {
+                    return _data_file_path.string() + "." + std::to_string(s + 1);
+                }
+
+                //maps the segment of the item on first access. Null if the segment was released.
+                data_type* find(size_t pos) const
+                {
+                    INVARIANT(_items);
+                    if(pos < _first_items) return _items + pos;
+
+                    const auto s = segment_of(pos);
+                    REQUIRE_LESS(s, _segments.size());
+
+                    //released segments are never recreated
+                    if(s < _released) return nullptr;
+
+                    auto& segment = _segments[s];
+                    if(!segment)
+                    {
+                        segment = std::make_unique<mapped_file>();
+                        open(*segment, segment_path(s), _segment_items * sizeof(data_type));
+                        CHECK_GREATER_EQUAL(segment->size(), _segment_items * sizeof(data_type));
+                    }
+
+                    const auto offset = (pos - _first_items) - (s * _segment_items);
+                    return reinterpret_cast<data_type*>(segment->data()) + offset;
+                }
+
+            private:
+                //items start after the metadata, aligned for types like 128 bit sums
+                static constexpr std::size_t ITEMS_OFFSET = 
+                    (sizeof(meta_t) + alignof(data_type) - 1) / alignof(data_type) * alignof(data_type);
+
+            private:
+                meta_t* _metadata = nullptr;
+                data_type* _items = nullptr;
+                std::size_t _first_items = 0;
+                std::size_t _segment_items = 1;
+                std::size_t _released = 0;      //segments before this one were released
+                mapped_file_ptr _data_file;
+                boost::filesystem::path _data_file_path;
+                mutable std::vector<mapped_file_ptr> _segments;
+        };
+}
+#endif
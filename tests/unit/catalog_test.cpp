@@ -0,0 +1,137 @@
+#include "test.hpp"
+#include "db/catalog.hpp"
+
+#include <fstream>
+
+using namespace henhouse;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    //an empty timeline index where the db would put the key split into directories
+    void make_timeline(const fs::path& root, const fs::path& dirs)
+    {
+        fs::create_directories(root / dirs);
+        std::ofstream{(root / dirs / "_.i").string()};
+    }
+
+    void adds_keys()
+    {
+        const auto dir = test::temp_dir("catalog_add");
+        db::key_catalog c{dir};
+        EXPECT_EQUAL(c.size(), 0u);
+
+        c.add("cpu");
+        c.add("cpu");
+        c.add("mem");
+        EXPECT_EQUAL(c.size(), 2u);
+        EXPECT(c.contains("cpu"));
+        EXPECT(!c.contains("cp"));
+    }
+
+    void compacts_log_on_reload()
+    {
+        const auto dir = test::temp_dir("catalog_reload");
+        {
+            db::key_catalog c{dir};
+            for(int i = 0; i < 100; i++) c.add("key" + std::to_string(i));
+        }
+        EXPECT(fs::file_size(dir / ".keys") > 0);
+
+        {
+            db::key_catalog c{dir};
+            EXPECT_EQUAL(c.size(), 100u);
+            EXPECT(c.contains("key42"));
+
+            //merged into the table, so the log starts empty
+            EXPECT_EQUAL(fs::file_size(dir / ".keys"), 0u);
+            EXPECT(fs::file_size(dir / ".keys.table") > 0);
+            EXPECT(!fs::exists(dir / ".keys.table.tmp"));
+
+            //added twice, once in the table and once in the log, is still one key
+            c.add("key42");
+            c.add("new");
+        }
+
+        db::key_catalog c{dir};
+        EXPECT_EQUAL(c.size(), 101u);
+        EXPECT(c.contains("new"));
+    }
+
+    void scans_in_order()
+    {
+        const auto dir = test::temp_dir("catalog_scan");
+        {
+            db::key_catalog c{dir};
+            c.add("cpu1");
+            c.add("cpu3");
+            c.add("mem");
+        }
+
+        //cpu1 and cpu3 are in the table and cpu2 and cpu4 in memory
+        db::key_catalog c{dir};
+        c.add("cpu4");
+        c.add("cpu2");
+        c.add("a");
+
+        EXPECT(c.scan("cpu", "", false, 10) == (db::key_list{"cpu1", "cpu2", "cpu3", "cpu4"}));
+        EXPECT(c.scan("cpu", "", false, 3) == (db::key_list{"cpu1", "cpu2", "cpu3"}));
+        EXPECT(c.scan("cpu", "cpu2", true, 10) == (db::key_list{"cpu3", "cpu4"}));
+        EXPECT(c.scan("cpu", "cpu4", true, 10).empty());
+        EXPECT(c.scan("", "", false, 10) == (db::key_list{"a", "cpu1", "cpu2", "cpu3", "cpu4", "mem"}));
+        EXPECT(c.scan("disk", "", false, 10).empty());
+    }
+
+    void rebuilds_from_directories()
+    {
+        const auto dir = test::temp_dir("catalog_rebuild");
+        make_timeline(dir, "cp/u");
+        make_timeline(dir, "me/m");
+        make_timeline(dir, ".hidden/x");
+
+        db::key_catalog c{dir};
+        EXPECT_EQUAL(c.size(), 2u);
+        EXPECT(c.contains("cpu"));
+        EXPECT(c.contains("mem"));
+    }
+
+    void rebuilds_corrupt_table()
+    {
+        const auto dir = test::temp_dir("catalog_corrupt");
+        make_timeline(dir, "cp/u");
+        {
+            db::key_catalog c{dir};
+            make_timeline(dir, "me/m");
+            c.add("mem");
+        }
+
+        //keys added after the table was written are only in the log
+        {
+            db::key_catalog c{dir};
+            c.add("late");
+        }
+
+        //a count larger than the file
+        {
+            std::ofstream t{(dir / ".keys.table").string(), std::ios::out | std::ios::trunc | std::ios::binary};
+            const std::uint64_t count = 1000;
+            t.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        }
+
+        db::key_catalog c{dir};
+        EXPECT_EQUAL(c.size(), 3u);
+        EXPECT(c.contains("cpu"));
+        EXPECT(c.contains("mem"));
+        EXPECT(c.contains("late"));
+    }
+}
+
+int main()
+{
+    return test::run({
+            {"adds_keys", adds_keys},
+            {"compacts_log_on_reload", compacts_log_on_reload},
+            {"scans_in_order", scans_in_order},
+            {"rebuilds_from_directories", rebuilds_from_directories},
+            {"rebuilds_corrupt_table", rebuilds_corrupt_table}});
+}
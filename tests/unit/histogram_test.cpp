@@ -0,0 +1,93 @@
+#include "test.hpp"
+#include "db/histogram.hpp"
+
+#include <cmath>
+#include <limits>
+
+using namespace henhouse;
+
+namespace
+{
+    bool close(double a, double b)
+    {
+        return std::abs(a - b) <= 1e-9 * std::max(1.0, std::abs(b));
+    }
+
+    void bins_values()
+    {
+        EXPECT_EQUAL(db::histogram_bin(-5), 0u);
+        EXPECT_EQUAL(db::histogram_bin(0), 0u);
+        EXPECT_EQUAL(db::histogram_bin(1), 1u);
+        EXPECT_EQUAL(db::histogram_bin(2), 3u);
+        EXPECT_EQUAL(db::histogram_bin(3), 4u);
+        EXPECT_EQUAL(db::histogram_bin(4), 5u);
+        EXPECT_EQUAL(db::histogram_bin(std::numeric_limits<db::count_type>::max()), db::HISTOGRAM_BINS - 1);
+
+        //every value falls within the bounds of its bin
+        for(db::count_type v = 1; v < 100000; v = v * 3 / 2 + 1)
+        {
+            const auto b = db::histogram_bin(v);
+            EXPECT(db::bin_lower(b) <= v);
+            EXPECT(v < db::bin_upper(b));
+        }
+
+        for(std::size_t b = 1; b < db::HISTOGRAM_BINS; b++)
+            EXPECT(close(db::bin_lower(b), db::bin_upper(b - 1)));
+    }
+
+    void estimates_quantiles()
+    {
+        db::histogram_bins h{};
+        EXPECT_EQUAL(db::quantile(h, 0.5), 0.0);
+
+        //100 observations in bin 5, [4, 5.66)
+        h[5] = 100;
+        EXPECT_EQUAL(db::observations(h), 100);
+        EXPECT(close(db::quantile(h, 0.0), db::bin_lower(5)));
+        EXPECT(close(db::quantile(h, 0.5), (db::bin_lower(5) + db::bin_upper(5)) / 2));
+        EXPECT(close(db::quantile(h, 1.0), db::bin_upper(5)));
+
+        h[1] = 100;
+        EXPECT(close(db::quantile(h, 0.25), (db::bin_lower(1) + db::bin_upper(1)) / 2));
+        EXPECT(db::quantile(h, 0.75) >= db::bin_lower(5));
+
+        //quantiles never decrease
+        double prev = 0;
+        for(double q = 0; q <= 1.0; q += 0.01)
+        {
+            const auto v = db::quantile(h, q);
+            EXPECT(v >= prev);
+            prev = v;
+        }
+    }
+
+    void histogram_ranges()
+    {
+        const auto dir = test::temp_dir("histogram_range");
+        db::histogram_index idx{dir / "_.h"};
+
+        idx.grow(10);
+        idx.observe(2, 1);
+        idx.observe(2, 3);
+        idx.observe(5, 100);
+        idx.observe(9, 1);
+        idx.grow(12);
+
+        EXPECT_EQUAL(idx.size(), 12u);
+        EXPECT_EQUAL(db::observations(idx.range(0, 11)), 4);
+        EXPECT_EQUAL(db::observations(idx.range(3, 8)), 1);
+        EXPECT_EQUAL(db::observations(idx.range(10, 11)), 0);
+
+        const auto h = idx.range(2, 2);
+        EXPECT_EQUAL(h[db::histogram_bin(1)], 1);
+        EXPECT_EQUAL(h[db::histogram_bin(3)], 1);
+    }
+}
+
+int main()
+{
+    return test::run({
+            {"bins_values", bins_values},
+            {"estimates_quantiles", estimates_quantiles},
+            {"histogram_ranges", histogram_ranges}});
+}
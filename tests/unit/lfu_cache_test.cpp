@@ -0,0 +1,143 @@
+#include "test.hpp"
+#include "util/lfu_cache.hpp"
+
+using namespace henhouse;
+
+namespace
+{
+    using cache = util::lfu_cache<int, int>;
+
+    //looks the key up and caches it on a miss, like the db does with timelines
+    void use(cache& c, int k)
+    {
+        if(!c.find(k)) c.set(k, k);
+    }
+
+    void caches_values()
+    {
+        cache c{10};
+        EXPECT(c.find(1) == nullptr);
+
+        c.set(1, 10);
+        EXPECT(c.find(1) != nullptr);
+        EXPECT_EQUAL(*c.find(1), 10);
+        EXPECT_EQUAL(c.size(), 1u);
+
+        EXPECT(c.erase(1));
+        EXPECT(!c.erase(1));
+        EXPECT(c.peek(1) == nullptr);
+        EXPECT(c.empty());
+    }
+
+    void never_grows_past_capacity()
+    {
+        cache c{50};
+        for(int k = 0; k < 1000; k++) use(c, k);
+
+        EXPECT_EQUAL(c.size(), 50u);
+        EXPECT_EQUAL(c.stats().evictions, 950u);
+        EXPECT_EQUAL(c.stats().size, 50u);
+    }
+
+    void counts_hits_and_misses()
+    {
+        cache c{10};
+        use(c, 1);
+        use(c, 1);
+        use(c, 2);
+        c.peek(1);
+        c.missed(3);
+
+        const auto s = c.stats();
+        EXPECT_EQUAL(s.hits, 1u);
+        EXPECT_EQUAL(s.misses, 3u);
+    }
+
+    //a scan of keys used once must not flush keys that are used again and again
+    void scan_keeps_hot_keys()
+    {
+        cache c{100};
+        for(int r = 0; r < 5; r++)
+            for(int k = 0; k < 50; k++) use(c, k);
+
+        //hot keys stay in use during the scan, so aging alone doesn't fade them
+        for(int k = 1000; k < 11000; k++)
+        {
+            use(c, k);
+            if(k % 500 == 0)
+                for(int h = 0; h < 50; h++) use(c, h);
+        }
+
+        int cached = 0;
+        for(int k = 0; k < 50; k++) if(c.peek(k)) cached++;
+        EXPECT_EQUAL(cached, 50);
+    }
+
+    //a new key leaving the window is only admitted if it is used more than the victim
+    void admits_frequent_keys()
+    {
+        cache c{100};
+        for(int r = 0; r < 2; r++)
+            for(int k = 0; k < 100; k++) use(c, k);
+
+        //looked up often before it is cached, so the sketch knows it
+        for(int i = 0; i < 10; i++) c.find(500);
+        c.set(500, 500);
+        use(c, 501);
+        EXPECT(c.peek(500) != nullptr);
+    }
+
+    //a key used once stays out without displacing keys used often, even when
+    //small integer keys land in the same sketch columns
+    void rejects_rare_keys()
+    {
+        cache c{100};
+        for(int r = 0; r < 4; r++)
+            for(int k = 0; k < 100; k++) use(c, k);
+
+        use(c, 600);
+        use(c, 601);
+        EXPECT(c.peek(600) == nullptr);
+
+        int cached = 0;
+        for(int k = 0; k < 100; k++) if(c.peek(k)) cached++;
+        EXPECT_EQUAL(cached, 99);
+    }
+
+    void sketch_separates_integer_keys()
+    {
+        util::frequency_sketch s{100};
+        std::hash<int> h;
+        for(int i = 0; i < 10; i++) s.add(h(42));
+
+        //same low bits as 42, so they only differ once the hash is mixed
+        int shadowed = 0;
+        for(int k = 1; k <= 8; k++) if(s.estimate(h(42 + k * 128)) > 0) shadowed++;
+        EXPECT(shadowed < 8);
+    }
+
+    void sketch_ages_counts()
+    {
+        util::frequency_sketch s{16};
+        for(int i = 0; i < 10; i++) s.add(42);
+        const auto before = s.estimate(42);
+        EXPECT(before >= 10);
+
+        //enough other keys to trigger aging halves the counts
+        for(std::size_t i = 0; i < 1000; i++) s.add(i * 7919 + 1);
+        EXPECT(s.estimate(42) < before);
+    }
+}
+
+int main()
+{
+    return test::run({
+            {"caches_values", caches_values},
+            {"never_grows_past_capacity", never_grows_past_capacity},
+            {"counts_hits_and_misses", counts_hits_and_misses},
+            {"scan_keeps_hot_keys", scan_keeps_hot_keys},
+            {"admits_frequent_keys", admits_frequent_keys},
+            {"rejects_rare_keys", rejects_rare_keys},
+            {"sketch_separates_integer_keys", sketch_separates_integer_keys},
+            {"sketch_ages_counts", sketch_ages_counts}});
+}
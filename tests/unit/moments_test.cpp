@@ -0,0 +1,77 @@
+#include "test.hpp"
+#include "db/moments.hpp"
+
+#include <vector>
+
+using namespace henhouse;
+
+namespace
+{
+    struct item
+    {
+        db::count_type value;
+    };
+
+    using items = std::vector<item>;
+
+    void moments_of_small_values()
+    {
+        const auto dir = test::temp_dir("moments_small");
+        db::moments_index idx{dir / "_.m"};
+
+        items data{{1}, {-2}, {3}, {0}, {5}};
+        idx.update(data, 0);
+        EXPECT_EQUAL(idx.size(), data.size());
+
+        const auto all = idx.range(0, 4);
+        EXPECT(all.third_integral == 1 - 8 + 27 + 125);
+        EXPECT(all.fourth_integral == 1 + 16 + 81 + 625);
+
+        const auto mid = idx.range(1, 2);
+        EXPECT(mid.third_integral == -8 + 27);
+        EXPECT(mid.fourth_integral == 16 + 81);
+
+        //a late put recomputes from its position
+        data[1].value = 2;
+        data.push_back({-1});
+        idx.update(data, 1);
+        EXPECT(idx.range(1, 5).third_integral == 8 + 27 + 125 - 1);
+    }
+
+    void moments_wrap_around()
+    {
+        const auto dir = test::temp_dir("moments_wrap");
+        db::moments_index idx{dir / "_.m"};
+
+        //fourth powers of 3e9 are about 2^126, so a few of them wrap the 128 bit prefix sums
+        const db::count_type big = 3000000000;
+        items data;
+        for(int i = 0; i < 10; i++) data.push_back({i % 2 ? big : -big});
+        data.push_back({7});
+        data.push_back({-3});
+        idx.update(data, 0);
+
+        const auto small = idx.range(10, 11);
+        EXPECT(small.third_integral == 343 - 27);
+        EXPECT(small.fourth_integral == 2401 + 81);
+
+        const db::wide_count_type b = big;
+        const auto one = idx.range(7, 7);
+        EXPECT(one.third_integral == b * b * b);
+        EXPECT(one.fourth_integral == b * b * b * b);
+
+        const auto pair = idx.range(8, 9);
+        EXPECT(pair.third_integral == 0);
+        EXPECT(pair.fourth_integral == 2 * b * b * b * b);
+
+        const auto tail = idx.range(9, 11);
+        EXPECT(tail.third_integral == b * b * b + 343 - 27);
+    }
+}
+
+int main()
+{
+    return test::run({
+            {"moments_of_small_values", moments_of_small_values},
+            {"moments_wrap_around", moments_wrap_around}});
+}
@@ -0,0 +1,112 @@
+#include "test.hpp"
+#include "util/segmented_vector.hpp"
+
+#include <stdexcept>
+
+using namespace henhouse;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    struct meta
+    {
+        std::size_t size = 0;
+    };
+
+    using vector = util::segmented_vector<meta, std::uint64_t>;
+
+    const std::size_t FIRST_SIZE = util::PAGE_SIZE * 2;
+    const std::size_t SEGMENT_ITEMS = util::PAGE_SIZE / sizeof(std::uint64_t);
+
+    //items in the first file after the metadata
+    const std::size_t FIRST_ITEMS = (FIRST_SIZE - sizeof(meta)) / sizeof(std::uint64_t);
+
+    void fill(vector& v, std::size_t n)
+    {
+        for(std::size_t i = v.size(); i < n; i++) v.push_back(i + 1);
+    }
+
+    void grows_into_segments()
+    {
+        const auto dir = test::temp_dir("svector_grow");
+        const auto n = FIRST_ITEMS + SEGMENT_ITEMS * 3 + 10;
+        {
+            vector v{dir / "_.d", FIRST_SIZE, SEGMENT_ITEMS};
+            fill(v, n);
+            EXPECT_EQUAL(v.size(), n);
+            EXPECT(fs::exists(dir / "_.d.4"));
+            EXPECT(!fs::exists(dir / "_.d.5"));
+        }
+
+        vector v{dir / "_.d", FIRST_SIZE, SEGMENT_ITEMS};
+        EXPECT_EQUAL(v.size(), n);
+        bool all = true;
+        for(std::size_t i = 0; i < n; i++) all = all && v[i] == i + 1;
+        EXPECT(all);
+    }
+
+    void releases_front_segments()
+    {
+        const auto dir = test::temp_dir("svector_release");
+        vector v{dir / "_.d", FIRST_SIZE, SEGMENT_ITEMS};
+
+        const auto n = FIRST_ITEMS + SEGMENT_ITEMS * 4 + 10;
+        fill(v, n);
+
+        //the middle of the third segment, so the first two are unlinked
+        const auto pos = FIRST_ITEMS + SEGMENT_ITEMS * 2 + 5;
+        v.release_front(pos);
+        EXPECT_EQUAL(v.size(), n);
+        EXPECT(!fs::exists(dir / "_.d.1"));
+        EXPECT(!fs::exists(dir / "_.d.2"));
+        EXPECT(fs::exists(dir / "_.d.3"));
+
+        const auto& c = v;
+        EXPECT_EQUAL(c[FIRST_ITEMS], 0u);
+        EXPECT_EQUAL(c[FIRST_ITEMS + SEGMENT_ITEMS * 2 - 1], 0u);
+        EXPECT_EQUAL(c[pos], pos + 1);
+        EXPECT_THROW(v[FIRST_ITEMS + 1] = 1, std::out_of_range);
+
+        //the released segment is not recreated when unmapped segments map again
+        v.release_pages();
+        EXPECT_EQUAL(c[FIRST_ITEMS + 1], 0u);
+        EXPECT(!fs::exists(dir / "_.d.1"));
+
+        //released again further along, only the new segments are unlinked
+        fill(v, n + SEGMENT_ITEMS);
+        v.release_front(FIRST_ITEMS + SEGMENT_ITEMS * 3);
+        EXPECT(!fs::exists(dir / "_.d.3"));
+        EXPECT(fs::exists(dir / "_.d.4"));
+        EXPECT_EQUAL(v.back(), n + SEGMENT_ITEMS);
+    }
+
+    void reopens_released()
+    {
+        const auto dir = test::temp_dir("svector_reopen");
+        const auto n = FIRST_ITEMS + SEGMENT_ITEMS * 3 + 10;
+        {
+            vector v{dir / "_.d", FIRST_SIZE, SEGMENT_ITEMS};
+            fill(v, n);
+            v.release_front(FIRST_ITEMS + SEGMENT_ITEMS * 2);
+        }
+
+        vector v{dir / "_.d", FIRST_SIZE, SEGMENT_ITEMS};
+        const auto& c = v;
+        EXPECT_EQUAL(v.size(), n);
+        EXPECT_EQUAL(c[FIRST_ITEMS + 3], 0u);
+        EXPECT_EQUAL(c[FIRST_ITEMS + SEGMENT_ITEMS * 2], FIRST_ITEMS + SEGMENT_ITEMS * 2 + 1);
+        EXPECT_THROW(v[FIRST_ITEMS + SEGMENT_ITEMS] = 1, std::out_of_range);
+        EXPECT(!fs::exists(dir / "_.d.1"));
+
+        v.push_back(7);
+        EXPECT_EQUAL(v.back(), 7u);
+    }
+}
+
+int main()
+{
+    return test::run({
+            {"grows_into_segments", grows_into_segments},
+            {"releases_front_segments", releases_front_segments},
+            {"reopens_released", reopens_released}});
+}
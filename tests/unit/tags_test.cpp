@@ -0,0 +1,236 @@
+#include "test.hpp"
+#include "db/tags.hpp"
+
+#include <stdexcept>
+
+using namespace henhouse;
+
+namespace
+{
+    db::tag_exprs query(const std::string& call)
+    {
+        db::tag_exprs e;
+        if(!db::parse_series_by_tag(call, e)) throw std::invalid_argument{"not seriesByTag: " + call};
+        return e;
+    }
+
+    void parses_tagged_series()
+    {
+        db::tagged_series s;
+        EXPECT(db::parse_tagged("cpu;host=a;dc=east", s));
+        EXPECT_EQUAL(s.name, "cpu");
+        EXPECT_EQUAL(s.tags.size(), 2u);
+        EXPECT_EQUAL(s.tags[0].name, "dc");
+        EXPECT_EQUAL(s.tags[0].value, "east");
+        EXPECT_EQUAL(s.tags[1].name, "host");
+
+        EXPECT(!db::parse_tagged("cpu", s));
+        EXPECT(!db::parse_tagged(";dc=east", s));
+        EXPECT(!db::parse_tagged("cpu;dc", s));
+        EXPECT(!db::parse_tagged("cpu;dc=", s));
+        EXPECT(!db::parse_tagged("cpu;=east", s));
+        EXPECT(!db::parse_tagged("cpu;name=x", s));
+        EXPECT(!db::parse_tagged("cpu;dc=east;dc=west", s));
+    }
+
+    void parses_series_by_tag()
+    {
+        db::tag_exprs e;
+        EXPECT(!db::parse_series_by_tag("cpu.*", e));
+
+        e = query(" seriesByTag('name=cpu', \"dc!=east\", 'host=~web-(1|2)', 'os!=~win.*') ");
+        EXPECT_EQUAL(e.size(), 4u);
+        EXPECT(e[0].op == db::tag_op::equal);
+        EXPECT_EQUAL(e[0].tag, "name");
+        EXPECT_EQUAL(e[0].value, "cpu");
+        EXPECT(e[1].op == db::tag_op::not_equal);
+        EXPECT(e[2].op == db::tag_op::match);
+        EXPECT_EQUAL(e[2].value, "web-(1|2)");
+        EXPECT(e[3].op == db::tag_op::not_match);
+
+        //commas in quotes belong to the expression
+        e = query("seriesByTag('host=~a{1,2}')");
+        EXPECT_EQUAL(e.size(), 1u);
+        EXPECT_EQUAL(e[0].value, "a{1,2}");
+
+        EXPECT_THROW(query("seriesByTag('dc=east'"), std::invalid_argument);
+        EXPECT_THROW(query("seriesByTag('dc=east',)"), std::invalid_argument);
+        EXPECT_THROW(query("seriesByTag('dc=east)"), std::invalid_argument);
+        EXPECT_THROW(query("seriesByTag('east')"), std::invalid_argument);
+        EXPECT_THROW(query("seriesByTag('=east')"), std::invalid_argument);
+    }
+
+    //ids with small and large gaps across several blocks
+    db::series_ids sample_ids(db::series_id step, std::size_t n)
+    {
+        db::series_ids ids;
+        db::series_id id = 3;
+        for(std::size_t i = 0; i < n; i++)
+        {
+            ids.push_back(id);
+            id += (i % 7 == 0) ? step * 1000 : 1 + i % step;
+        }
+        return ids;
+    }
+
+    void posting_list_round_trips()
+    {
+        const auto ids = sample_ids(300, 1000);
+
+        db::posting_list l;
+        for(const auto id : ids) l.add(id);
+        EXPECT_EQUAL(l.size(), ids.size());
+
+        db::series_ids read;
+        for(db::posting_list::cursor c{l}; !c.done(); c.next()) read.push_back(c.value());
+        EXPECT(read == ids);
+
+        db::posting_list empty;
+        EXPECT(db::posting_list::cursor{empty}.done());
+    }
+
+    void posting_list_seeks()
+    {
+        const auto ids = sample_ids(50, 700);
+
+        db::posting_list l;
+        for(const auto id : ids) l.add(id);
+
+        //seek to every id and between ids, within a block and across blocks
+        for(db::series_id target = 0; target < ids.back() + 2; target += 97)
+        {
+            db::posting_list::cursor c{l};
+            c.seek(target);
+
+            const auto expected = std::lower_bound(std::begin(ids), std::end(ids), target);
+            if(expected == std::end(ids)) EXPECT(c.done());
+            else EXPECT(!c.done() && c.value() == *expected);
+        }
+
+        //a cursor only moves forward
+        db::posting_list::cursor c{l};
+        c.seek(ids[300]);
+        c.seek(ids[10]);
+        EXPECT_EQUAL(c.value(), ids[300]);
+
+        c.seek(ids[db::posting_list::BLOCK_SIZE * 4]);
+        EXPECT_EQUAL(c.value(), ids[db::posting_list::BLOCK_SIZE * 4]);
+        c.next();
+        EXPECT_EQUAL(c.value(), ids[db::posting_list::BLOCK_SIZE * 4 + 1]);
+    }
+
+    void intersects_lists()
+    {
+        db::posting_list evens, threes, all;
+        for(db::series_id id = 0; id < 2000; id++)
+        {
+            if(id % 2 == 0) evens.add(id);
+            if(id % 3 == 0) threes.add(id);
+            all.add(id);
+        }
+
+        const auto ids = db::intersect({&evens, &all, &threes}, 1000);
+        EXPECT_EQUAL(ids.size(), 334u);
+        EXPECT(std::all_of(std::begin(ids), std::end(ids), [](db::series_id i) { return i % 6 == 0;}));
+        EXPECT(std::is_sorted(std::begin(ids), std::end(ids)));
+
+        EXPECT_EQUAL(db::intersect({&evens, &threes}, 5).size(), 5u);
+
+        db::posting_list none;
+        EXPECT(db::intersect({&evens, &none}, 10).empty());
+    }
+
+    void finds_series()
+    {
+        const auto dir = test::temp_dir("tags_find");
+        db::tag_index idx{dir};
+
+        idx.add("cpu;dc=east;host=web-1");
+        idx.add("cpu;dc=east;host=web-2");
+        idx.add("cpu;dc=west;host=web-3");
+        idx.add("mem;dc=east;host=web-1");
+        idx.add("cpu;dc=east;host=db-1;os=linux");
+        EXPECT_EQUAL(idx.size(), 5u);
+
+        using keys = db::key_list;
+        EXPECT(idx.find(query("seriesByTag('name=cpu', 'dc=east')"), 10) ==
+                (keys{"cpu_dc_east_host_web_1", "cpu_dc_east_host_web_2", "cpu_dc_east_host_db_1_os_linux"}));
+
+        EXPECT(idx.find(query("seriesByTag('dc=east', 'name!=cpu')"), 10) == (keys{"mem_dc_east_host_web_1"}));
+
+        EXPECT(idx.find(query("seriesByTag('host=~web-[12]', 'name=cpu')"), 10) ==
+                (keys{"cpu_dc_east_host_web_1", "cpu_dc_east_host_web_2"}));
+
+        //regexes match from the start of the value
+        EXPECT(idx.find(query("seriesByTag('host=~eb')"), 10).empty());
+        EXPECT_EQUAL(idx.find(query("seriesByTag('host=~web')"), 10).size(), 4u);
+
+        EXPECT(idx.find(query("seriesByTag('name=cpu', 'host!=~web.*')"), 10) ==
+                (keys{"cpu_dc_east_host_db_1_os_linux"}));
+
+        //a missing tag has an empty value
+        EXPECT_EQUAL(idx.find(query("seriesByTag('name=cpu', 'os=')"), 10).size(), 3u);
+
+        EXPECT_EQUAL(idx.find(query("seriesByTag('name=cpu')"), 2).size(), 2u);
+        EXPECT(idx.find(query("seriesByTag('name=disk')"), 10).empty());
+
+        EXPECT_THROW(idx.find(query("seriesByTag('dc!=east')"), 10), std::invalid_argument);
+        EXPECT_THROW(idx.find(query("seriesByTag('host=~(')"), 10), std::invalid_argument);
+    }
+
+    void skips_invalid_and_repeated_keys()
+    {
+        const auto dir = test::temp_dir("tags_invalid");
+        db::tag_index idx{dir};
+
+        idx.add("cpu.total");
+        idx.add("cpu;dc");
+        idx.add("cpu;name=x");
+        EXPECT_EQUAL(idx.size(), 0u);
+        EXPECT(!idx.contains("cpu;dc"));
+
+        idx.add("cpu;dc=east;host=a-1");
+        idx.add("cpu;dc=east;host=a-1");
+        idx.add("cpu;dc=east;host=a.1");
+        EXPECT_EQUAL(idx.size(), 2u);
+
+        //both series share the timeline of their sanatized key
+        EXPECT(idx.find(query("seriesByTag('dc=east')"), 10) == (db::key_list{"cpu_dc_east_host_a_1"}));
+    }
+
+    void reloads_from_log()
+    {
+        const auto dir = test::temp_dir("tags_reload");
+        {
+            db::tag_index idx{dir};
+            for(int i = 0; i < 300; i++)
+                idx.add("cpu;dc=" + std::string{i % 2 ? "east" : "west"} + ";host=h" + std::to_string(i));
+            idx.add("bad;tag");
+        }
+
+        db::tag_index idx{dir};
+        EXPECT_EQUAL(idx.size(), 300u);
+        EXPECT(idx.contains("cpu;dc=west;host=h0"));
+
+        const auto east = idx.find(query("seriesByTag('dc=east')"), 1000);
+        EXPECT_EQUAL(east.size(), 150u);
+        EXPECT_EQUAL(east.front(), "cpu_dc_east_host_h1");
+
+        //new series keep getting ids after the loaded ones
+        idx.add("cpu;dc=east;host=new");
+        EXPECT_EQUAL(idx.find(query("seriesByTag('dc=east')"), 1000).back(), "cpu_dc_east_host_new");
+    }
+}
+
+int main()
+{
+    return test::run({
+            {"parses_tagged_series", parses_tagged_series},
+            {"parses_series_by_tag", parses_series_by_tag},
+            {"posting_list_round_trips", posting_list_round_trips},
+            {"posting_list_seeks", posting_list_seeks},
+            {"intersects_lists", intersects_lists},
+            {"finds_series", finds_series},
+            {"skips_invalid_and_repeated_keys", skips_invalid_and_repeated_keys},
+            {"reloads_from_log", reloads_from_log}});
+}
@@ -0,0 +1,75 @@
+#ifndef HENHOUSE_TEST_H
+#define HENHOUSE_TEST_H
+
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace henhouse::test
+{
+    /**
+     * Minimal test runner so the tests don't need a framework. Each test is a
+     * function registered with a name. Failed expectations are reported and
+     * the test keeps going, so one run shows every failure.
+     */
+    using test_fn = std::function<void()>;
+    using tests = std::vector<std::pair<std::string, test_fn>>;
+
+    inline std::size_t& failures()
+    {
+        static std::size_t f = 0;
+        return f;
+    }
+
+    inline void fail(const char* file, int line, const std::string& what)
+    {
+        failures()++;
+        std::cerr << file << ":" << line << ": expected " << what << std::endl;
+    }
+
+    //runs all tests and returns the exit code of the test program
+    inline int run(const tests& ts)
+    {
+        for(const auto& t : ts)
+        {
+            const auto before = failures();
+            try { t.second(); }
+            catch(std::exception& e)
+            {
+                failures()++;
+                std::cerr << t.first << ": unexpected exception: " << e.what() << std::endl;
+            }
+            std::cerr << (failures() == before ? "ok   " : "FAIL ") << t.first << std::endl;
+        }
+        return failures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    //an empty directory for a test, removed first if a previous run left it
+    inline boost::filesystem::path temp_dir(const std::string& name)
+    {
+        const auto dir = boost::filesystem::temp_directory_path() / ("henhouse_test_" + name);
+        boost::filesystem::remove_all(dir);
+        boost::filesystem::create_directories(dir);
+        return dir;
+    }
+}
+
+#define EXPECT(c) \
+    do { if(!(c)) henhouse::test::fail(__FILE__, __LINE__, #c); } while(false)
+
+#define EXPECT_EQUAL(a, b) \
+    do { if(!((a) == (b))) henhouse::test::fail(__FILE__, __LINE__, #a " == " #b); } while(false)
+
+#define EXPECT_THROW(e, type) \
+    do { \
+        bool thrown = false; \
+        try { e; } catch(const type&) { thrown = true; } \
+        if(!thrown) henhouse::test::fail(__FILE__, __LINE__, #e " to throw " #type); \
+    } while(false)
+
+#endif
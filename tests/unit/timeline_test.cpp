@@ -0,0 +1,147 @@
+#include "test.hpp"
+#include "db/timeline.hpp"
+
+using namespace henhouse;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    const db::time_type RES = 10;
+    const db::time_type START = 1000000;
+
+    //puts 1 into each of n buckets after the ones already there
+    void fill(db::timeline& t, std::size_t n)
+    {
+        const auto from = t.data.size();
+        for(std::size_t i = from; i < from + n; i++) t.put(START + i * RES, 1);
+    }
+
+    std::size_t segment_files(const fs::path& dir)
+    {
+        std::size_t n = 0;
+        for(fs::directory_iterator it{dir}, end; it != end; it++)
+            if(it->path().filename().string().find("_.d.") == 0) n++;
+        return n;
+    }
+
+    void truncates_to_retention()
+    {
+        const auto dir = test::temp_dir("timeline_truncate");
+        auto t = db::from_directory((dir / "raw").string(), RES);
+        auto r = db::from_directory((dir / "rolled").string(), RES, db::NO_FEATURES, {100});
+        fill(t, 600);
+        fill(r, 600);
+
+        EXPECT(t.truncate(START + 3000));
+        EXPECT(r.truncate(START + 3000));
+        EXPECT_EQUAL(t.index.front().pos, 300u);
+        EXPECT_EQUAL(t.index.front().time, START + 3000);
+        EXPECT(!t.truncate(START + 2000));
+
+        //sums after the start don't change and the rollup agrees with the data
+        const auto raw = t.diff(START + 3000, START + 5000, 0);
+        const auto rolled = r.diff(START + 3000, START + 5000, 0);
+        EXPECT_EQUAL(raw.sum, 200);
+        EXPECT_EQUAL(rolled.sum, raw.sum);
+        EXPECT_EQUAL(rolled.variance, raw.variance);
+        EXPECT_EQUAL(t.diff(START + 3050, START + 4950, 0).sum, 190);
+
+        //puts keep adding to the truncated timelines. A diff has the buckets after a up to b.
+        fill(t, 10);
+        fill(r, 10);
+        EXPECT_EQUAL(t.diff(START + 5000, START + 6090, 0).sum, 109);
+        EXPECT_EQUAL(r.diff(START + 5000, START + 6090, 0).sum, 109);
+
+        //only sealed buckets are released
+        EXPECT(t.truncate(START + 6090));
+        EXPECT_EQUAL(t.index.front().pos, t.sealed_size() - 1);
+    }
+
+    void truncated_rollup_survives_reopen()
+    {
+        const auto dir = test::temp_dir("timeline_reopen");
+        {
+            auto t = db::from_directory(dir.string(), RES, db::NO_FEATURES, {100});
+            fill(t, 600);
+            t.truncate(START + 3000);
+        }
+
+        auto t = db::from_directory(dir.string(), RES, db::NO_FEATURES, {100});
+        EXPECT_EQUAL(t.index.front().pos, 300u);
+        EXPECT_EQUAL(t.rollups.size(), 1u);
+        EXPECT(t.rolled_up(t.rollups.front()));
+        EXPECT_EQUAL(t.diff(START + 3000, START + 5000, 0).sum, 200);
+
+        auto read = db::read_directory(dir.string(), RES, {100});
+        EXPECT_EQUAL(read.rollups.size(), 1u);
+        EXPECT_EQUAL(read.diff(START + 3000, START + 5000, 0).sum, 200);
+    }
+
+    void ring_wraps()
+    {
+        const auto dir = test::temp_dir("timeline_ring");
+        const db::offset_type ring = 100;
+        auto t = db::from_directory(dir.string(), RES, db::NO_FEATURES, {}, ring);
+
+        for(int step = 0; step < 20; step++)
+        {
+            fill(t, 97);
+
+            const auto kept = t.data.size() - t.index.front().pos;
+            EXPECT(t.data.size() < ring || kept >= ring);
+            EXPECT(kept <= ring + ring / 4);
+        }
+
+        //the last ring buckets are still there and the rest of the data is released
+        const auto end = START + (t.data.size() - 1) * RES;
+        EXPECT_EQUAL(t.diff(end - ring * RES, end, 0).sum, static_cast<db::count_type>(ring));
+        EXPECT(segment_files(dir) <= 2);
+    }
+
+    void versions_sealed_ranges()
+    {
+        const auto dir = test::temp_dir("timeline_version");
+        db::version_type sealed = 0;
+        db::version_type open = 0;
+        {
+            auto t = db::from_directory(dir.string(), RES);
+            fill(t, 200);
+
+            sealed = t.version(START + 100 * RES);
+            open = t.version(START + 190 * RES);
+            EXPECT_EQUAL(sealed % 2, 0u);
+            EXPECT_EQUAL(open % 2, 1u);
+
+            //a put changes the unsealed range only
+            fill(t, 1);
+            EXPECT_EQUAL(t.version(START + 100 * RES), sealed);
+            EXPECT(t.version(START + 190 * RES) != open);
+        }
+
+        {
+            auto t = db::from_directory(dir.string(), RES);
+            EXPECT_EQUAL(t.version(START + 100 * RES), sealed);
+            EXPECT(t.version(START + 190 * RES) != open);
+
+            EXPECT(t.truncate(START + 50 * RES));
+            EXPECT(t.version(START + 100 * RES) != sealed);
+        }
+
+        //a diff with features or rollups returns more, so its version differs
+        const auto truncated = db::from_directory(dir.string(), RES).version(START + 100 * RES);
+        const auto featured = db::from_directory(dir.string(), RES, db::EXTREMA_FEATURE).version(START + 100 * RES);
+        EXPECT(featured != truncated);
+
+        const auto rolled = db::from_directory(dir.string(), RES, db::EXTREMA_FEATURE, {100}).version(START + 100 * RES);
+        EXPECT(rolled != featured);
+    }
+}
+
+int main()
+{
+    return test::run({
+            {"truncates_to_retention", truncates_to_retention},
+            {"truncated_rollup_survives_reopen", truncated_rollup_survives_reopen},
+            {"ring_wraps", ring_wraps},
+            {"versions_sealed_ranges", versions_sealed_ranges}});
+}